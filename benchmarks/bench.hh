@@ -0,0 +1,42 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_BENCH_H
+#define BSON_BENCH_H
+#include<chrono>
+#include<cstdio>
+
+/**
+ * \brief Run f repeats times and report the best throughput
+ *
+ * f returns the number of bytes it processed. The best of all runs is
+ * reported, which is the least disturbed by other processes.
+ */
+template<class F>
+double benchmark( const char *name, int repeats, F f ) {
+	double best = 0;
+	for ( int i = 0; i < repeats; ++i ) {
+		auto start = std::chrono::steady_clock::now();
+		size_t bytes = f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double rate = bytes / elapsed.count() / 1e9;
+		if (rate > best)
+			best = rate;
+	}
+	printf( "%-40s %8.3f GB/s\n", name, best );
+	return best;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Emitting a million element array with BSONEmitter, compared to the
+// driver's BSONArrayBuilder which formats every index
+#include<vector>
+#include "bson/bson_stream.hh"
+#include "bench.hh"
+
+int main() {
+	std::vector<double> vd( 1000000 );
+	std::vector<int> vi( 1000000 );
+	for ( size_t i = 0; i < vd.size(); ++i ) {
+		vd[i] = 0.5*i;
+		vi[i] = i;
+	}
+
+	benchmark( "BSONArrayBuilder, 1M doubles", 10, [&]() {
+			mongo::BSONArrayBuilder barr;
+			for ( auto d : vd )
+				barr.append( d );
+			return (size_t) mongo::BSONObjBuilder().append( "a", barr.arr() )
+				.obj().objsize();
+		} );
+	benchmark( "BSONEmitter, 1M doubles", 10, [&]() {
+			mongo::BSONEmitter emit;
+			emit << "a" << vd;
+			return (size_t) emit.obj().objsize();
+		} );
+	benchmark( "BSONArrayBuilder, 1M ints", 10, [&]() {
+			mongo::BSONArrayBuilder barr;
+			for ( auto i : vi )
+				barr.append( i );
+			return (size_t) mongo::BSONObjBuilder().append( "a", barr.arr() )
+				.obj().objsize();
+		} );
+	benchmark( "BSONEmitter, 1M ints", 10, [&]() {
+			mongo::BSONEmitter emit;
+			emit << "a" << vi;
+			return (size_t) emit.obj().objsize();
+		} );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Extended JSON throughput for metric-like documents, measured on the
+// size of the JSON text, compared to the driver's jsonString()
+#include<random>
+#include<vector>
+#include "bson/bson_json.hh"
+#include "bench.hh"
+
+int main() {
+	// Full precision doubles, as produced by measurements
+	std::mt19937_64 random( 42 );
+	std::uniform_real_distribution<double> values( 0, 1000 );
+	std::vector<mongo::BSONObj> docs;
+	for ( int i = 0; i < 100000; ++i ) {
+		std::vector<double> samples( 8 );
+		for ( auto &sample : samples )
+			sample = values( random );
+		docs.push_back( mongo::BSONObjBuilder().append( "name", "latency" )
+				.append( "count", i ).append( "mean", values( random ) )
+				.append( "samples", samples ).obj() );
+	}
+
+	mongo::ExtJSONWriter writer;
+	for ( auto &bobj : docs )
+		writer << bobj;
+	const std::string json = writer.str();
+
+	benchmark( "ExtJSONWriter", 10, [&]() {
+			writer.clear();
+			for ( auto &bobj : docs )
+				writer << bobj;
+			return writer.str().size();
+		} );
+	benchmark( "BSONObj::jsonString", 10, [&]() {
+			size_t bytes = 0;
+			for ( auto &bobj : docs )
+				bytes += bobj.jsonString().size();
+			return bytes;
+		} );
+	benchmark( "ExtJSONReader", 10, [&]() {
+			mongo::ExtJSONReader reader( json );
+			mongo::BSONObj bobj;
+			while ( reader.next( bobj ) ) {}
+			return json.size();
+		} );
+	benchmark( "fromjson", 10, [&]() {
+			size_t pos = 0;
+			while ( pos < json.size() ) {
+				size_t end = json.find( '\n', pos );
+				mongo::fromjson( json.substr( pos, end - pos ) );
+				pos = end + 1;
+			}
+			return json.size();
+		} );
+	return EXIT_SUCCESS;
+}
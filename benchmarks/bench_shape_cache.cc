@@ -0,0 +1,61 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Decoding a few fields of many same-shaped documents, with a reused
+// BSONProjection compared to a reused BSONCachedProjection
+#include<string>
+#include<vector>
+#include "bson/bson_shape_cache.hh"
+#include "bench.hh"
+
+class metric {
+	public:
+		long long count;
+		double mean;
+		double p99;
+};
+
+int main() {
+	std::vector<mongo::BSONObj> docs;
+	size_t bytes = 0;
+	for ( int i = 0; i < 100000; ++i ) {
+		mongo::BSONObjBuilder builder;
+		for ( int j = 0; j < 16; ++j )
+			builder.append( "field" + std::to_string( j ), 0.5*j );
+		builder.append( "count", (long long) i ).append( "mean", 0.5*i )
+			.append( "p99", 2.0*i ).append( "tag", "not decoded" );
+		docs.push_back( builder.obj() );
+		bytes += docs.back().objsize();
+	}
+
+	metric m;
+	mongo::BSONProjection proj;
+	proj.add( "count", m.count ).add( "mean", m.mean ).add( "p99", m.p99 );
+	double general = benchmark( "BSONProjection", 10, [&]() {
+			for ( auto &bobj : docs )
+				bobj >> proj;
+			return bytes;
+		} );
+
+	mongo::BSONCachedProjection<metric> cached;
+	cached.add( "count", m.count ).add( "mean", m.mean ).add( "p99", m.p99 );
+	double fast = benchmark( "BSONCachedProjection", 10, [&]() {
+			for ( auto &bobj : docs )
+				bobj >> cached;
+			return bytes;
+		} );
+	printf( "Speedup of the cached layout: %.2fx\n", fast / general );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_CANONICAL_H
+#define BSON_CANONICAL_H
+#include<algorithm>
+#include<cstring>
+#include<vector>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief 64 bit content hash, reading 8 bytes at a time
+	 *
+	 * Every word is mixed with the MurmurHash3 finalizer, which does not
+	 * depend on the previous words, so only one multiply per word is on the
+	 * dependency chain.
+	 */
+	class BSONContentHash {
+		public:
+			static unsigned long long hash( const char *data, size_t len ) {
+				const unsigned long long multiplier = 0x9e3779b97f4a7c15ULL;
+				unsigned long long h = len * multiplier;
+				size_t i = 0;
+				for ( ; i + 8 <= len; i += 8 ) {
+					unsigned long long word;
+					memcpy( &word, data + i, sizeof( word ) );
+					h = ( h ^ mix( word ) ) * multiplier;
+				}
+				unsigned long long tail = 0;
+				memcpy( &tail, data + i, len - i );
+				h = ( h ^ mix( tail ) ) * multiplier;
+				return mix( h );
+			}
+
+		protected:
+			static unsigned long long mix( unsigned long long k ) {
+				k ^= k >> 33;
+				k *= 0xff51afd7ed558ccdULL;
+				k ^= k >> 33;
+				k *= 0xc4ceb9fe1a85ec53ULL;
+				k ^= k >> 33;
+				return k;
+			}
+	};
+
+	/**
+	 * \brief Emitter that produces a canonical encoding of the emitted values
+	 *
+	 * Logically equal values result in identical bytes, which makes the
+	 * output usable for content hashing and deduplication:
+	 * - fields of (embedded) objects are sorted on their name, array
+	 *   elements keep their order
+	 * - -0.0 is stored as 0.0 and all NaNs as the same quiet NaN
+	 * - int is widened to long long, so the integer width does not depend
+	 *   on the C++ type used
+	 *
+	 * Unordered containers are already emitted in a deterministic order by
+	 * all emitters.
+	 *
+	 * Values are first emitted as usual. obj() then checks the emitted
+	 * object in one read-only pass. Objects that are already canonical,
+	 * e.g. because fields are emitted in name order and no int or negative
+	 * zero is used, are returned as is. Only other objects are copied into
+	 * a canonical buffer. The hash is computed over the final buffer, 8
+	 * bytes at a time.
+	 *
+	 * obj() hides BSONEmitter::obj(), which is not virtual. Code that only
+	 * holds a BSONEmitter & and calls obj() on it gets the non canonical
+	 * bytes and leaves hash() untouched, so always call obj() on the
+	 * BSONCanonicalEmitter itself.
+	 *
+	 * \code
+	 * mongo::BSONCanonicalEmitter emit;
+	 * emit << t;
+	 * mongo::BSONObj bobj = emit.obj();
+	 * unsigned long long key = emit.hash();
+	 * \endcode
+	 */
+	class BSONCanonicalEmitter : public BSONEmitter {
+		public:
+			BSONCanonicalEmitter() : BSONEmitter(), hashValue( 0 ) {}
+
+			BSONObj obj() {
+				BSONObj bobj = BSONEmitter::obj();
+				if (!isCanonical( bobj, true )) {
+					BSONObjBuilder canonical( bobj.objsize() + 64 );
+					appendElements( canonical, bobj, true );
+					bobj = canonical.obj();
+				}
+				hashValue = BSONContentHash::hash( bobj.objdata(), bobj.objsize() );
+				return bobj;
+			}
+
+			/// Content hash of the last object returned by obj()
+			unsigned long long hash() const {
+				return hashValue;
+			}
+
+		protected:
+			static bool isCanonical( const BSONObj &bobj, bool sortedFields ) {
+				const char *previous = NULL;
+				for ( BSONObjIterator i( bobj ); i.more(); ) {
+					BSONElement bel = i.next();
+					if (sortedFields && previous && strcmp( previous, bel.fieldName() ) > 0)
+						return false;
+					previous = bel.fieldName();
+					switch ( bel.type() ) {
+						case NumberInt:
+							return false;
+						case NumberDouble: {
+							double d = bel.Double();
+							double canonical = canonicalDouble( d );
+							if (memcmp( &d, &canonical, sizeof( double ) ) != 0)
+								return false;
+							break;
+						}
+						case Object:
+						case Array:
+							if (!isCanonical( bel.embeddedObject(), bel.type() == Object ))
+								return false;
+							break;
+						default:
+							break;
+					}
+				}
+				return true;
+			}
+
+			static void appendElements( BSONObjBuilder &builder,
+					const BSONObj &bobj, bool sortFields ) {
+				std::vector<BSONElement> elements;
+				for ( BSONObjIterator i( bobj ); i.more(); )
+					elements.push_back( i.next() );
+				if (sortFields)
+					std::stable_sort( elements.begin(), elements.end(),
+							[]( const BSONElement &a, const BSONElement &b ) {
+								return strcmp( a.fieldName(), b.fieldName() ) < 0;
+							} );
+				for ( auto &bel : elements )
+					appendElement( builder, bel );
+			}
+
+			static void appendElement( BSONObjBuilder &builder, const BSONElement &bel ) {
+				switch ( bel.type() ) {
+					case NumberDouble:
+						builder.append( bel.fieldName(), canonicalDouble( bel.Double() ) );
+						break;
+					case NumberInt:
+						builder.append( bel.fieldName(), (long long) bel.Int() );
+						break;
+					case Object:
+					case Array: {
+						BSONObjBuilder sub( bel.type() == Object ?
+								builder.subobjStart( bel.fieldName() ) :
+								builder.subarrayStart( bel.fieldName() ) );
+						appendElements( sub, bel.embeddedObject(), bel.type() == Object );
+						sub.done();
+						break;
+					}
+					default:
+						builder.append( bel );
+				}
+			}
+
+			unsigned long long hashValue;
+	};
+};
+
+#endif
@@ -0,0 +1,402 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_COMPRESSED_H
+#define BSON_COMPRESSED_H
+#include<algorithm>
+#include<cstdint>
+#include<cstring>
+#include<istream>
+#include<limits>
+#include<ostream>
+#include<string>
+#include<vector>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief LZ77 block codec in the style of LZ4
+	 *
+	 * A compressed block is a sequence of (literals, match) pairs. Each pair
+	 * starts with a token byte: the high nibble is the number of literals and
+	 * the low nibble the match length minus 4. A nibble of 15 is followed by
+	 * extra length bytes, which are added until a byte below 255. The
+	 * literals follow, then the match offset as 2 little endian bytes. The
+	 * last pair only has literals.
+	 */
+	class BSONBlockCodec {
+		public:
+			static void compress( const char *src, size_t size, std::string &out ) {
+				std::vector<int> table( 1 << hashBits, -1 );
+				size_t anchor = 0;
+				size_t pos = 0;
+				// Leave room for reading 4 bytes at every position
+				size_t limit = size < minMatch ? 0 : size - minMatch + 1;
+				while ( pos < limit ) {
+					uint32_t sequence;
+					memcpy( &sequence, src + pos, minMatch );
+					uint32_t hash = ( sequence * 2654435761U ) >> ( 32 - hashBits );
+					int candidate = table[hash];
+					table[hash] = pos;
+					if (candidate < 0 || pos - candidate > maxOffset
+							|| memcmp( src + candidate, src + pos, minMatch ) != 0) {
+						++pos;
+						continue;
+					}
+					size_t length = minMatch;
+					while ( pos + length < size && src[candidate + length] == src[pos + length] )
+						++length;
+					writeSequence( out, src + anchor, pos - anchor, pos - candidate, length );
+					pos += length;
+					anchor = pos;
+				}
+				writeSequence( out, src + anchor, size - anchor, 0, 0 );
+			}
+
+			/// Decompress into dest, which must be exactly the uncompressed size
+			static void decompress( const char *src, size_t size, char *dest, size_t destSize ) {
+				const unsigned char *in = (const unsigned char *) src;
+				const unsigned char *inEnd = in + size;
+				char *out = dest;
+				char *outEnd = dest + destSize;
+				while ( in < inEnd ) {
+					unsigned char token = *in++;
+					size_t literals = readLength( in, inEnd, token >> 4 );
+					if (literals > (size_t) ( inEnd - in ) || literals > (size_t) ( outEnd - out ))
+						corrupt();
+					memcpy( out, in, literals );
+					in += literals;
+					out += literals;
+					if (in == inEnd)
+						break;
+
+					if (inEnd - in < 2)
+						corrupt();
+					size_t offset = in[0] | ( in[1] << 8 );
+					in += 2;
+					size_t length = readLength( in, inEnd, token & 15 ) + minMatch;
+					if (offset == 0 || offset > (size_t) ( out - dest )
+							|| length > (size_t) ( outEnd - out ))
+						corrupt();
+					// Matches can overlap with the bytes they produce, so copy forward
+					const char *match = out - offset;
+					for ( size_t i = 0; i < length; ++i )
+						out[i] = match[i];
+					out += length;
+				}
+				if (out != outEnd)
+					corrupt();
+			}
+
+			/// "BSNZ", the first bytes of a compressed stream
+			static const uint32_t streamMagic = 0x5a4e5342;
+			static const uint32_t streamVersion = 1;
+
+			/// Blocks are indexed with int, and their sizes stored as 32 bit ints
+			static const size_t maxBlockSize = std::numeric_limits<int>::max();
+
+			/**
+			 * \brief Largest uncompressed size that storedSize compressed bytes can hold
+			 *
+			 * A byte of compressed data expands to at most 255 bytes: an extra
+			 * length byte adds at most 255 to a match, and the token and offset
+			 * of a match produce at most 19 bytes for 3 bytes of input.
+			 */
+			static long long maxExpandedSize( long long storedSize ) {
+				return storedSize * 255;
+			}
+
+			/// Store value as 4 little endian bytes, as used in the stream headers
+			static void storeUInt32( char *dest, uint32_t value ) {
+				for ( int i = 0; i < 4; ++i )
+					dest[i] = (char) ( value >> ( 8*i ) );
+			}
+
+			static uint32_t loadUInt32( const char *src ) {
+				const unsigned char *p = (const unsigned char *) src;
+				return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+			}
+
+		protected:
+			static const int hashBits = 14;
+			static const size_t minMatch = 4;
+			static const size_t maxOffset = 65535;
+
+			static void writeLength( std::string &out, size_t length ) {
+				for ( ; length >= 255; length -= 255 )
+					out.push_back( (char) 255 );
+				out.push_back( (char) length );
+			}
+
+			static void writeSequence( std::string &out, const char *literals,
+					size_t literalSize, size_t offset, size_t length ) {
+				size_t matchLength = length ? length - minMatch : 0;
+				out.push_back( (char) ( ( std::min<size_t>( literalSize, 15 ) << 4 )
+							| std::min<size_t>( matchLength, 15 ) ) );
+				if (literalSize >= 15)
+					writeLength( out, literalSize - 15 );
+				out.append( literals, literalSize );
+				if (!length)
+					return;
+				out.push_back( (char) ( offset & 0xff ) );
+				out.push_back( (char) ( offset >> 8 ) );
+				if (matchLength >= 15)
+					writeLength( out, matchLength - 15 );
+			}
+
+			static size_t readLength( const unsigned char *&in, const unsigned char *inEnd,
+					size_t length ) {
+				if (length < 15)
+					return length;
+				unsigned char extra;
+				do {
+					if (in == inEnd)
+						corrupt();
+					extra = *in++;
+					length += extra;
+				} while ( extra == 255 );
+				return length;
+			}
+
+			static void corrupt() {
+				throw MsgAssertionException( 0, "Corrupt compressed BSON block" );
+			}
+	};
+
+	/**
+	 * \brief A block of documents, as stored in a compressed stream
+	 *
+	 * Blocks are compressed independently, so decompress() of different
+	 * blocks can run on different threads.
+	 */
+	class BSONBlock {
+		public:
+			BSONBlock() : rawSize( 0 ), pos( 0 ) {}
+
+			/// Decompress the stored bytes, after which next() returns the documents
+			void decompress() {
+				raw.resize( rawSize );
+				if (stored.size() == (size_t) rawSize)
+					raw.swap( stored );
+				else
+					BSONBlockCodec::decompress( stored.data(), stored.size(), &raw[0], rawSize );
+				stored.clear();
+				pos = 0;
+			}
+
+			/**
+			 * \brief Next document in the block
+			 *
+			 * The document points into the block, and is only valid as long
+			 * as the block is not reused. Use getOwned() to keep it longer.
+			 */
+			bool next( BSONObj &bobj ) {
+				if (pos == raw.size())
+					return false;
+				int objsize;
+				if (raw.size() - pos < sizeof( int ))
+					corrupt();
+				memcpy( &objsize, raw.data() + pos, sizeof( int ) );
+				if (objsize < 5 || (size_t) objsize > raw.size() - pos)
+					corrupt();
+				BSONObj candidate( raw.data() + pos );
+				if (!candidate.valid())
+					corrupt();
+				bobj = candidate;
+				pos += objsize;
+				return true;
+			}
+
+			template<class T>
+				bool next( T &t ) {
+					BSONObj bobj;
+					if (!next( bobj ))
+						return false;
+					bobj >> t;
+					return true;
+				}
+
+			int rawSize;
+			std::string stored;
+
+		protected:
+			static void corrupt() {
+				throw MsgAssertionException( 0, "Corrupt document in BSON block" );
+			}
+
+			std::string raw;
+			size_t pos;
+	};
+
+	/**
+	 * \brief Write documents as a stream of compressed blocks
+	 *
+	 * The stream starts with the magic bytes "BSNZ" and a format version,
+	 * as a little endian 32 bit int. Documents are gathered until the block
+	 * size is reached, after which the block is compressed and written with
+	 * a header of two little endian 32 bit ints: the uncompressed and the
+	 * stored size. Blocks that do not compress are stored as is. The last
+	 * block is written on flush() or destruction. A block is flushed early
+	 * when the next document would take it beyond maxBlockSize, and a
+	 * larger blockSize is rejected.
+	 *
+	 * \code
+	 * std::ofstream file( "archive.bsonz", std::ios::binary );
+	 * mongo::BSONBlockWriter writer( file );
+	 * for ( auto &t : ts )
+	 *     writer << t;
+	 * \endcode
+	 */
+	class BSONBlockWriter {
+		public:
+			BSONBlockWriter( std::ostream &out, size_t blockSize = 1024*1024 )
+				: out( out ), blockSize( blockSize ) {
+				if (blockSize > BSONBlockCodec::maxBlockSize)
+					throw MsgAssertionException( 0, "BSON block size too large" );
+				char header[8];
+				BSONBlockCodec::storeUInt32( header, BSONBlockCodec::streamMagic );
+				BSONBlockCodec::storeUInt32( header + 4, BSONBlockCodec::streamVersion );
+				out.write( header, sizeof( header ) );
+			}
+
+			~BSONBlockWriter() {
+				flush();
+			}
+
+			void write( const BSONObj &bobj ) {
+				if (raw.size() + bobj.objsize() > BSONBlockCodec::maxBlockSize)
+					flush();
+				raw.append( bobj.objdata(), bobj.objsize() );
+				if (raw.size() >= blockSize)
+					flush();
+			}
+
+			void flush() {
+				if (raw.empty())
+					return;
+				compressed.clear();
+				BSONBlockCodec::compress( raw.data(), raw.size(), compressed );
+				const std::string &stored = compressed.size() < raw.size() ? compressed : raw;
+				char header[8];
+				BSONBlockCodec::storeUInt32( header, raw.size() );
+				BSONBlockCodec::storeUInt32( header + 4, stored.size() );
+				out.write( header, sizeof( header ) );
+				out.write( stored.data(), stored.size() );
+				raw.clear();
+			}
+
+		protected:
+			std::ostream &out;
+			size_t blockSize;
+			std::string raw;
+			std::string compressed;
+	};
+
+	inline BSONBlockWriter &operator<<( BSONBlockWriter &writer, const BSONObj &bobj ) {
+		writer.write( bobj );
+		return writer;
+	}
+
+	template<class T>
+		BSONBlockWriter &operator<<( BSONBlockWriter &writer, const T &t ) {
+			BSONEmitter bbuild;
+			bbuild << t;
+			writer.write( bbuild.obj() );
+			return writer;
+		}
+
+	/**
+	 * \brief Read documents from a stream written by BSONBlockWriter
+	 *
+	 * Only one block is held in memory at a time. For parallel decoding,
+	 * read the blocks with nextBlock() and decompress them on other threads.
+	 * Streams without the expected magic bytes or with a newer format
+	 * version are rejected, and every document is validated before it is
+	 * returned.
+	 *
+	 * \code
+	 * std::ifstream file( "archive.bsonz", std::ios::binary );
+	 * mongo::BSONBlockReader reader( file );
+	 * T t;
+	 * while ( reader.next( t ) )
+	 *     process( t );
+	 * \endcode
+	 */
+	class BSONBlockReader {
+		public:
+			BSONBlockReader( std::istream &in ) : in( in ), headerRead( false ) {}
+
+			/// Read the next block without decompressing it
+			bool nextBlock( BSONBlock &block ) {
+				if (!headerRead)
+					readStreamHeader();
+				char header[8];
+				in.read( header, sizeof( header ) );
+				if (in.gcount() == 0 && in.eof())
+					return false;
+				int rawSize = (int) BSONBlockCodec::loadUInt32( header );
+				int storedSize = (int) BSONBlockCodec::loadUInt32( header + 4 );
+				// Checked before decompress() allocates rawSize bytes
+				if (in.gcount() != sizeof( header ) || rawSize < 0
+						|| storedSize < 0 || storedSize > rawSize
+						|| rawSize > BSONBlockCodec::maxExpandedSize( storedSize ))
+					throw MsgAssertionException( 0, "Corrupt BSON block header" );
+				block.rawSize = rawSize;
+				block.stored.resize( storedSize );
+				in.read( &block.stored[0], storedSize );
+				if (in.gcount() != storedSize)
+					throw MsgAssertionException( 0, "Truncated BSON block" );
+				return true;
+			}
+
+			/// Next document, only valid until the next call
+			bool next( BSONObj &bobj ) {
+				while ( !block.next( bobj ) ) {
+					if (!nextBlock( block ))
+						return false;
+					block.decompress();
+				}
+				return true;
+			}
+
+			template<class T>
+				bool next( T &t ) {
+					BSONObj bobj;
+					if (!next( bobj ))
+						return false;
+					bobj >> t;
+					return true;
+				}
+
+		protected:
+			void readStreamHeader() {
+				char header[8];
+				in.read( header, sizeof( header ) );
+				if (in.gcount() != sizeof( header )
+						|| BSONBlockCodec::loadUInt32( header ) != BSONBlockCodec::streamMagic)
+					throw MsgAssertionException( 0, "Not a compressed BSON stream" );
+				if (BSONBlockCodec::loadUInt32( header + 4 ) > BSONBlockCodec::streamVersion)
+					throw MsgAssertionException( 0, "Unsupported compressed BSON stream version" );
+				headerRead = true;
+			}
+
+			std::istream &in;
+			bool headerRead;
+			BSONBlock block;
+	};
+};
+
+#endif
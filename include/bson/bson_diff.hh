@@ -0,0 +1,203 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_DIFF_H
+#define BSON_DIFF_H
+#include<algorithm>
+#include<cstring>
+#include<string>
+#include<vector>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief Update document that turns one version of an object into another
+	 *
+	 * Both versions are compared field by field. Changed fields end up in
+	 * $set and removed fields in $unset, using dotted paths for fields of
+	 * embedded objects and arrays. Subtrees whose bytes are equal are
+	 * skipped with a single memcmp, so unchanged parts of a document are
+	 * cheap. Arrays that changed length are set as a whole.
+	 *
+	 * Field names that can not be part of an update path (empty, containing
+	 * a '.' or starting with '$') are handled by setting the embedded
+	 * object that holds them as a whole. At the top level this is not
+	 * possible, and the constructor throws a MsgAssertionException.
+	 *
+	 * User types are emitted with their operator<<, so the same overloads are
+	 * used as when storing the full document.
+	 *
+	 * \code
+	 * mongo::BSONDiff diff( stored, t );
+	 * if (diff.changed())
+	 *     connection.update( ns, BSON( "_id" << t.id ), diff.obj() );
+	 * \endcode
+	 */
+	class BSONDiff {
+		public:
+			BSONDiff( const BSONObj &before, const BSONObj &after )
+				: setCount( 0 ), unsetCount( 0 ), built( false ) {
+				diffRoot( before, after );
+			}
+
+			template<class T>
+				BSONDiff( const BSONObj &before, const T &after )
+					: setCount( 0 ), unsetCount( 0 ), built( false ) {
+					diffRoot( before, emit( after ) );
+				}
+
+			template<class T>
+				BSONDiff( const T &before, const T &after )
+					: setCount( 0 ), unsetCount( 0 ), built( false ) {
+					diffRoot( emit( before ), emit( after ) );
+				}
+
+			bool changed() const {
+				return setCount || unsetCount;
+			}
+
+			/// The update document, empty when nothing changed
+			BSONObj obj() {
+				if (!built) {
+					BSONObjBuilder builder;
+					if (setCount)
+						builder.append( "$set", set.obj() );
+					if (unsetCount)
+						builder.append( "$unset", unset.obj() );
+					update = builder.obj();
+					built = true;
+				}
+				return update;
+			}
+
+		protected:
+			template<class T>
+				static BSONObj emit( const T &t ) {
+					BSONEmitter bbuild;
+					bbuild << t;
+					return bbuild.obj();
+				}
+
+			static bool equal( const BSONElement &a, const BSONElement &b ) {
+				return a.type() == b.type() && a.valuesize() == b.valuesize()
+					&& memcmp( a.value(), b.value(), a.valuesize() ) == 0;
+			}
+
+			/// True when all field names of bobj can be used in an update path
+			static bool validNames( const BSONObj &bobj ) {
+				for ( BSONObjIterator i( bobj ); i.more(); ) {
+					const char *name = i.next().fieldName();
+					if (name[0] == '\0' || name[0] == '$' || strchr( name, '.' ))
+						return false;
+				}
+				return true;
+			}
+
+			void diffRoot( const BSONObj &before, const BSONObj &after ) {
+				if (!validNames( before ) || !validNames( after ))
+					throw MsgAssertionException( 0,
+							"Field name can not be used in an update path" );
+				std::string path;
+				diff( before, after, path );
+			}
+
+			void diff( const BSONObj &before, const BSONObj &after, std::string &path ) {
+				if (before.objsize() == after.objsize()
+						&& memcmp( before.objdata(), after.objdata(), before.objsize() ) == 0)
+					return;
+
+				std::vector<BSONElement> olds;
+				for ( BSONObjIterator i( before ); i.more(); )
+					olds.push_back( i.next() );
+				std::vector<bool> matched( olds.size(), false );
+				// Old field indices sorted on name, only built when fields are out of order
+				std::vector<size_t> byName;
+
+				size_t prefix = path.size();
+				// Fields are usually in the same order, so try the next old field first
+				size_t cursor = 0;
+				BSONObjIterator it( after );
+				while ( it.more() ) {
+					BSONElement bel = it.next();
+					size_t index = cursor;
+					if (index >= olds.size()
+							|| strcmp( olds[index].fieldName(), bel.fieldName() ) != 0)
+						index = find( olds, byName, bel.fieldName() );
+
+					path.resize( prefix );
+					path.append( bel.fieldName() );
+					if (index < olds.size()) {
+						// Continue after the matched field, so one inserted or
+						// reordered field does not disturb the rest
+						cursor = index + 1;
+						matched[index] = true;
+						const BSONElement &old = olds[index];
+						if (equal( old, bel ))
+							continue;
+						if (( old.type() == Object && bel.type() == Object
+									&& validNames( old.Obj() ) && validNames( bel.Obj() ) )
+								|| ( old.type() == Array && bel.type() == Array
+									&& old.Obj().nFields() == bel.Obj().nFields() )) {
+							path.push_back( '.' );
+							diff( old.Obj(), bel.Obj(), path );
+							continue;
+						}
+					}
+					set.appendAs( bel, path );
+					++setCount;
+				}
+
+				for ( size_t i = 0; i < olds.size(); ++i ) {
+					if (!matched[i]) {
+						path.resize( prefix );
+						path.append( olds[i].fieldName() );
+						unset.append( path, "" );
+						++unsetCount;
+					}
+				}
+				path.resize( prefix );
+			}
+
+			/// Index of the old field called name, or olds.size() when there is none
+			static size_t find( const std::vector<BSONElement> &olds,
+					std::vector<size_t> &byName, const char *name ) {
+				if (byName.empty() && !olds.empty()) {
+					for ( size_t i = 0; i < olds.size(); ++i )
+						byName.push_back( i );
+					std::stable_sort( byName.begin(), byName.end(),
+							[&olds]( size_t a, size_t b ) {
+								return strcmp( olds[a].fieldName(), olds[b].fieldName() ) < 0;
+							} );
+				}
+				auto pos = std::lower_bound( byName.begin(), byName.end(), name,
+						[&olds]( size_t a, const char *name ) {
+							return strcmp( olds[a].fieldName(), name ) < 0;
+						} );
+				if (pos == byName.end() || strcmp( olds[*pos].fieldName(), name ) != 0)
+					return olds.size();
+				return *pos;
+			}
+
+			BSONObjBuilder set;
+			BSONObjBuilder unset;
+			int setCount;
+			int unsetCount;
+			bool built;
+			BSONObj update;
+	};
+};
+
+#endif
@@ -0,0 +1,158 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_FIXED_LAYOUT_H
+#define BSON_FIXED_LAYOUT_H
+#include<cstring>
+#include<string>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief BSON type tag and value size of types with a fixed encoded size
+	 *
+	 * Only these types can be part of a BSONFixedLayout. They are encoded the
+	 * same way as by BSONEmitter (size_t is stored as long long).
+	 */
+	template<class T>
+		struct BSONFixedType;
+
+	template<>
+		struct BSONFixedType<double> {
+			static const char type = NumberDouble;
+			static const int size = 8;
+			static void write( char *dest, const double &t ) {
+				memcpy( dest, &t, size );
+			}
+		};
+
+	template<>
+		struct BSONFixedType<long long> {
+			static const char type = NumberLong;
+			static const int size = 8;
+			static void write( char *dest, const long long &t ) {
+				memcpy( dest, &t, size );
+			}
+		};
+
+	template<>
+		struct BSONFixedType<size_t> {
+			static const char type = NumberLong;
+			static const int size = 8;
+			static void write( char *dest, const size_t &t ) {
+				long long cpy = (long long) t;
+				memcpy( dest, &cpy, size );
+			}
+		};
+
+	template<>
+		struct BSONFixedType<int> {
+			static const char type = NumberInt;
+			static const int size = 4;
+			static void write( char *dest, const int &t ) {
+				memcpy( dest, &t, size );
+			}
+		};
+
+	template<>
+		struct BSONFixedType<bool> {
+			static const char type = Bool;
+			static const int size = 1;
+			static void write( char *dest, const bool &t ) {
+				*dest = t ? 1 : 0;
+			}
+		};
+
+	template<>
+		struct BSONFixedType<OID> {
+			static const char type = jstOID;
+			static const int size = 12;
+			static void write( char *dest, const OID &t ) {
+				memcpy( dest, t.getData(), size );
+			}
+		};
+
+	/**
+	 * \brief Emit a fixed set of fields by copying a precomputed skeleton
+	 *
+	 * For fields with fixed size types, the bytes of the type tags and
+	 * field names never change. They are laid out once, when the layout is
+	 * constructed. Emitting is then a single memcpy of this skeleton into
+	 * the emitter's buffer, after which the values are written at their
+	 * known offsets. The result is identical to streaming the fields one by
+	 * one. Variable sized fields can be streamed as usual after the fixed
+	 * block.
+	 *
+	 * \code
+	 * static const mongo::BSONFixedLayout<long long, double, bool> metricLayout(
+	 *     "count", "mean", "ok" );
+	 *
+	 * friend mongo::BSONEmitter &operator<<( mongo::BSONEmitter &emit, const metric &m ) {
+	 *     metricLayout.emit( emit, m.count, m.mean, m.ok );
+	 *     emit << "name" << m.name;
+	 *     return emit;
+	 * }
+	 * \endcode
+	 */
+	template<class... Ts>
+		class BSONFixedLayout {
+			public:
+				template<class... Names>
+					BSONFixedLayout( Names... fieldNames ) {
+						static_assert( sizeof...( Names ) == sizeof...( Ts ),
+								"BSONFixedLayout needs one field name per type" );
+						static_assert( sizeof...( Ts ) > 0,
+								"BSONFixedLayout needs at least one field" );
+						const char *names[] = { fieldNames... };
+						const char types[] = { BSONFixedType<Ts>::type... };
+						const int sizes[] = { BSONFixedType<Ts>::size... };
+						for ( size_t i = 0; i < sizeof...( Ts ); ++i ) {
+							skeleton.push_back( types[i] );
+							skeleton.append( names[i] );
+							skeleton.push_back( '\0' );
+							offsets[i] = skeleton.size();
+							skeleton.append( sizes[i], '\0' );
+						}
+					}
+
+				BSONEmitter &emit( BSONEmitter &emitter, const Ts&... values ) const {
+					char *dest = emitter.builder->bb().grow( skeleton.size() );
+					memcpy( dest, skeleton.data(), skeleton.size() );
+					write( dest, offsets, values... );
+					return emitter;
+				}
+
+				/// Number of bytes added to the emitter per emit()
+				size_t size() const {
+					return skeleton.size();
+				}
+
+			protected:
+				void write( char *, const size_t * ) const {}
+
+				template<class T, class... Rest>
+					void write( char *dest, const size_t *offset,
+							const T &value, const Rest&... rest ) const {
+						BSONFixedType<T>::write( dest + *offset, value );
+						write( dest, offset + 1, rest... );
+					}
+
+				std::string skeleton;
+				size_t offsets[sizeof...( Ts )];
+		};
+};
+
+#endif
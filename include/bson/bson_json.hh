@@ -0,0 +1,1041 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_JSON_H
+#define BSON_JSON_H
+#include<algorithm>
+#include<cerrno>
+#include<cmath>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<limits>
+#include<string>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/// 10^k for 0 <= k <= 22, all of which are exact doubles
+	inline double exactPowerOfTen( int k ) {
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+			1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+			1e20, 1e21, 1e22 };
+		return powers[k];
+	}
+
+	/**
+	 * \brief Write BSON documents as MongoDB Extended JSON (v2)
+	 *
+	 * Documents are appended to a reusable buffer, one document per line.
+	 * In relaxed mode (the default) numbers are written as plain JSON
+	 * numbers, in canonical mode they are wrapped ({"$numberInt": "1"}) so
+	 * their exact BSON type survives a round trip. Long long values are
+	 * always wrapped in $numberLong, because their type would otherwise be
+	 * lost when reading the JSON back in.
+	 *
+	 * Any type that can be streamed into a BSONEmitter can be written
+	 * directly:
+	 * \code
+	 * mongo::ExtJSONWriter writer;
+	 * writer << t;
+	 * std::cout << writer.str();
+	 * writer.clear(); // Keeps the allocated buffer
+	 * \endcode
+	 */
+	class ExtJSONWriter {
+		public:
+			ExtJSONWriter( bool canonical = false ) : canonical( canonical ) {}
+
+			void write( const BSONObj &bobj ) {
+				writeObject( bobj, false );
+				out.push_back( '\n' );
+			}
+
+			const std::string &str() const {
+				return out;
+			}
+
+			void clear() {
+				out.clear();
+			}
+
+		protected:
+			void writeObject( const BSONObj &bobj, bool isArray ) {
+				out.push_back( isArray ? '[' : '{' );
+				bool first = true;
+				for ( BSONObjIterator i( bobj ); i.more(); ) {
+					BSONElement bel = i.next();
+					if (!first)
+						out.push_back( ',' );
+					first = false;
+					if (!isArray) {
+						writeString( bel.fieldName(), bel.fieldNameSize() - 1 );
+						out.push_back( ':' );
+					}
+					writeValue( bel );
+				}
+				out.push_back( isArray ? ']' : '}' );
+			}
+
+			void writeValue( const BSONElement &bel ) {
+				const char *value = bel.value();
+				switch ( bel.type() ) {
+					case NumberDouble: {
+						double d;
+						memcpy( &d, value, sizeof( double ) );
+						writeDouble( d );
+						break;
+					}
+					case String:
+						writeString( value + 4, bel.valuestrsize() - 1 );
+						break;
+					case Object:
+					case Array:
+						writeObject( bel.embeddedObject(), bel.type() == Array );
+						break;
+					case BinData: {
+						int len;
+						memcpy( &len, value, sizeof( int ) );
+						out.append( "{\"$binary\":{\"base64\":\"" );
+						writeBase64( value + 5, len );
+						out.append( "\",\"subType\":\"" );
+						writeHex( value + 4, 1 );
+						out.append( "\"}}" );
+						break;
+					}
+					case Undefined:
+						out.append( "{\"$undefined\":true}" );
+						break;
+					case jstOID:
+						out.append( "{\"$oid\":\"" );
+						writeHex( value, 12 );
+						out.append( "\"}" );
+						break;
+					case Bool:
+						out.append( *value ? "true" : "false" );
+						break;
+					case Date: {
+						long long millis;
+						memcpy( &millis, value, sizeof( long long ) );
+						out.append( "{\"$date\":{\"$numberLong\":\"" );
+						writeInteger( millis );
+						out.append( "\"}}" );
+						break;
+					}
+					case jstNULL:
+						out.append( "null" );
+						break;
+					case RegEx: {
+						size_t patternLen = strlen( value );
+						out.append( "{\"$regularExpression\":{\"pattern\":" );
+						writeString( value, patternLen );
+						out.append( ",\"options\":" );
+						writeString( value + patternLen + 1, strlen( value + patternLen + 1 ) );
+						out.append( "}}" );
+						break;
+					}
+					case Code:
+						out.append( "{\"$code\":" );
+						writeString( value + 4, bel.valuestrsize() - 1 );
+						out.push_back( '}' );
+						break;
+					case Symbol:
+						out.append( "{\"$symbol\":" );
+						writeString( value + 4, bel.valuestrsize() - 1 );
+						out.push_back( '}' );
+						break;
+					case NumberInt: {
+						int i;
+						memcpy( &i, value, sizeof( int ) );
+						if (canonical)
+							out.append( "{\"$numberInt\":\"" );
+						writeInteger( i );
+						if (canonical)
+							out.append( "\"}" );
+						break;
+					}
+					case Timestamp: {
+						unsigned int increment, time;
+						memcpy( &increment, value, sizeof( unsigned int ) );
+						memcpy( &time, value + 4, sizeof( unsigned int ) );
+						out.append( "{\"$timestamp\":{\"t\":" );
+						writeInteger( time );
+						out.append( ",\"i\":" );
+						writeInteger( increment );
+						out.append( "}}" );
+						break;
+					}
+					case NumberLong: {
+						long long l;
+						memcpy( &l, value, sizeof( long long ) );
+						out.append( "{\"$numberLong\":\"" );
+						writeInteger( l );
+						out.append( "\"}" );
+						break;
+					}
+					case MinKey:
+						out.append( "{\"$minKey\":1}" );
+						break;
+					case MaxKey:
+						out.append( "{\"$maxKey\":1}" );
+						break;
+					default:
+						throw MsgAssertionException( 0,
+								std::string( "Cannot write field as extended JSON: " )
+								+ bel.fieldName() );
+				}
+			}
+
+			void writeInteger( long long value ) {
+				// Digits are formatted back to front
+				char digits[21];
+				char *p = digits + sizeof( digits );
+				unsigned long long u = value < 0 ?
+					0ULL - (unsigned long long) value : (unsigned long long) value;
+				do {
+					*--p = '0' + (char) ( u % 10 );
+					u /= 10;
+				} while ( u );
+				if (value < 0)
+					*--p = '-';
+				out.append( p, digits + sizeof( digits ) - p );
+			}
+
+			void writeDouble( double d ) {
+				if (std::isnan( d ) || std::isinf( d )) {
+					out.append( "{\"$numberDouble\":\"" );
+					out.append( std::isnan( d ) ? "NaN" : ( d < 0 ? "-Infinity" : "Infinity" ) );
+					out.append( "\"}" );
+					return;
+				}
+				if (canonical)
+					out.append( "{\"$numberDouble\":\"" );
+				if (!writeShortDecimal( d )) {
+					// 17 significant digits always round trip
+					char buf[32];
+					int len = snprintf( buf, sizeof( buf ), "%.17g", d );
+					out.append( buf, len );
+				}
+				if (canonical)
+					out.append( "\"}" );
+			}
+
+			/**
+			 * \brief Write d as m/10^k with the smallest k, without printf
+			 *
+			 * Works for integers below 2^53, and for other values below 10^7
+			 * with at most 8 decimals, which covers most values in practice.
+			 * A single multiplication by 10^8 tells whether d has such a
+			 * short form: m*10^(8-k) is then below 2^50 and exact, so
+			 * rounding d*10^8 recovers it and dividing by 10^8 gives back
+			 * exactly d. Trailing zeros are stripped with integer
+			 * arithmetic. Other values return false without further work.
+			 */
+			bool writeShortDecimal( double d ) {
+				double magnitude = std::fabs( d );
+				unsigned long long m;
+				int k;
+				if (magnitude < 9007199254740992.0 && std::floor( magnitude ) == magnitude) {
+					m = (unsigned long long) magnitude;
+					k = 0;
+				} else if (magnitude < 1e7 && magnitude >= 1e-5) {
+					double scaled = std::floor( magnitude * 1e8 + 0.5 );
+					if (scaled / 1e8 != magnitude)
+						return false;
+					m = (unsigned long long) scaled;
+					k = 8;
+					while ( m % 10 == 0 ) {
+						m /= 10;
+						--k;
+					}
+				} else
+					return false;
+
+				// Digits are formatted back to front
+				char digits[24];
+				char *p = digits + sizeof( digits );
+				if (k == 0)
+					*--p = '0';
+				for ( int i = 0; i < k; ++i ) {
+					*--p = '0' + (char) ( m % 10 );
+					m /= 10;
+				}
+				*--p = '.';
+				do {
+					*--p = '0' + (char) ( m % 10 );
+					m /= 10;
+				} while ( m );
+				if (std::signbit( d ))
+					*--p = '-';
+				out.append( p, digits + sizeof( digits ) - p );
+				return true;
+			}
+
+			/// True if any byte of the word needs escaping: < 0x20, '"' or '\\'
+			static bool needsEscape( unsigned long long word ) {
+				const unsigned long long ones = 0x0101010101010101ULL;
+				const unsigned long long highs = 0x8080808080808080ULL;
+				unsigned long long quote = word ^ ( ones * '"' );
+				unsigned long long backslash = word ^ ( ones * '\\' );
+				return ( ( ( word - ones * 0x20 ) & ~word )
+						| ( ( quote - ones ) & ~quote )
+						| ( ( backslash - ones ) & ~backslash ) ) & highs;
+			}
+
+			void writeString( const char *str, size_t len ) {
+				static const char hex[] = "0123456789abcdef";
+				out.push_back( '"' );
+				size_t i = 0;
+				while ( i < len ) {
+					// Copy runs of bytes that need no escaping 8 at a time
+					size_t start = i;
+					unsigned long long word;
+					while ( i + 8 <= len ) {
+						memcpy( &word, str + i, sizeof( word ) );
+						if (needsEscape( word ))
+							break;
+						i += 8;
+					}
+					while ( i < len ) {
+						unsigned char c = str[i];
+						if (c < 0x20 || c == '"' || c == '\\')
+							break;
+						++i;
+					}
+					out.append( str + start, i - start );
+					if (i == len)
+						break;
+					unsigned char c = str[i++];
+					out.push_back( '\\' );
+					switch ( c ) {
+						case '"': out.push_back( '"' ); break;
+						case '\\': out.push_back( '\\' ); break;
+						case '\b': out.push_back( 'b' ); break;
+						case '\f': out.push_back( 'f' ); break;
+						case '\n': out.push_back( 'n' ); break;
+						case '\r': out.push_back( 'r' ); break;
+						case '\t': out.push_back( 't' ); break;
+						default:
+							out.append( "u00" );
+							out.push_back( hex[c >> 4] );
+							out.push_back( hex[c & 0xf] );
+					}
+				}
+				out.push_back( '"' );
+			}
+
+			void writeHex( const char *data, size_t len ) {
+				static const char hex[] = "0123456789abcdef";
+				for ( size_t i = 0; i < len; ++i ) {
+					unsigned char c = data[i];
+					out.push_back( hex[c >> 4] );
+					out.push_back( hex[c & 0xf] );
+				}
+			}
+
+			void writeBase64( const char *data, size_t len ) {
+				static const char table[] =
+					"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+				const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+				size_t i = 0;
+				for ( ; i + 3 <= len; i += 3 ) {
+					unsigned int v = ( p[i] << 16 ) | ( p[i+1] << 8 ) | p[i+2];
+					out.push_back( table[v >> 18] );
+					out.push_back( table[( v >> 12 ) & 63] );
+					out.push_back( table[( v >> 6 ) & 63] );
+					out.push_back( table[v & 63] );
+				}
+				if (i < len) {
+					unsigned int v = p[i] << 16;
+					if (i + 1 < len)
+						v |= p[i+1] << 8;
+					out.push_back( table[v >> 18] );
+					out.push_back( table[( v >> 12 ) & 63] );
+					out.push_back( i + 1 < len ? table[( v >> 6 ) & 63] : '=' );
+					out.push_back( '=' );
+				}
+			}
+
+			bool canonical;
+			std::string out;
+	};
+
+	/**
+	 * \brief Parse MongoDB Extended JSON (v2) into BSON documents
+	 *
+	 * Reads the relaxed and canonical forms written by ExtJSONWriter, and
+	 * $date as an ISO-8601 string ("1970-01-01T00:00:00.000Z", with an
+	 * optional fraction and a Z or +hh:mm offset) as written by other
+	 * Extended JSON producers.
+	 * Integers without fraction or exponent become int when they fit and
+	 * long long otherwise, other numbers become double. The input can hold
+	 * a sequence of documents separated by whitespace. The input is not
+	 * copied, so it has to outlive the reader.
+	 *
+	 * \code
+	 * mongo::ExtJSONReader reader( json );
+	 * mongo::BSONObj bobj;
+	 * while ( reader.next( bobj ) )
+	 *     bobj >> t;
+	 * \endcode
+	 */
+	class ExtJSONReader {
+		public:
+			ExtJSONReader( const std::string &json )
+				: pos( json.c_str() ), end( json.c_str() + json.size() ) {}
+
+			ExtJSONReader( const char *json )
+				: pos( json ), end( json + strlen( json ) ) {}
+
+			ExtJSONReader( const char *json, size_t len )
+				: pos( json ), end( json + len ) {}
+
+			/// Parse the next document, returns false at the end of the input
+			bool next( BSONObj &bobj ) {
+				skipSpace();
+				if (pos == end)
+					return false;
+				expect( '{' );
+				BSONObjBuilder builder;
+				readMembers( builder.bb() );
+				bobj = builder.obj();
+				return true;
+			}
+
+		protected:
+			void fail( const char *message ) {
+				throw MsgAssertionException( 0, std::string( "Invalid extended JSON: " )
+						+ message + " at '" + std::string( pos, std::min<size_t>( end - pos, 20 ) )
+						+ "'" );
+			}
+
+			void skipSpace() {
+				while ( pos < end && ( *pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t' ) )
+					++pos;
+			}
+
+			bool peek( char c ) {
+				skipSpace();
+				return pos < end && *pos == c;
+			}
+
+			void expect( char c ) {
+				if (!peek( c ))
+					fail( "unexpected character" );
+				++pos;
+			}
+
+			bool consume( const char *word ) {
+				size_t len = strlen( word );
+				if ((size_t) ( end - pos ) < len || memcmp( pos, word, len ) != 0)
+					return false;
+				pos += len;
+				return true;
+			}
+
+			/// Members of an object after its '{', written as elements into buf
+			void readMembers( BufBuilder &buf ) {
+				if (peek( '}' )) {
+					++pos;
+					return;
+				}
+				for (;;) {
+					skipSpace();
+					readString( name );
+					expect( ':' );
+					readValue( buf, name );
+					if (!peek( ',' ))
+						break;
+					++pos;
+				}
+				expect( '}' );
+			}
+
+			void readElements( BufBuilder &buf ) {
+				if (peek( ']' )) {
+					++pos;
+					return;
+				}
+				char key[12];
+				for ( int index = 0; ; ++index ) {
+					if (index < BSONArrayKeys::size) {
+						readValue( buf, BSONArrayKeys::key( index ) );
+					} else {
+						snprintf( key, sizeof( key ), "%d", index );
+						readValue( buf, key );
+					}
+					if (!peek( ',' ))
+						break;
+					++pos;
+				}
+				expect( ']' );
+			}
+
+			/// Write an embedded object/array, filling in its length prefix afterwards
+			template<class F>
+				void readEmbedded( BufBuilder &buf, BSONType type,
+						const StringData &field, F readContent ) {
+					buf.appendNum( (char) type );
+					buf.appendStr( field );
+					int start = buf.len();
+					buf.skip( 4 );
+					readContent();
+					buf.appendNum( (char) EOO );
+					int size = buf.len() - start;
+					memcpy( buf.buf() + start, &size, sizeof( int ) );
+				}
+
+			void readValue( BufBuilder &buf, const StringData &field ) {
+				skipSpace();
+				if (pos == end)
+					fail( "unexpected end of input" );
+				switch ( *pos ) {
+					case '"': {
+						readString( str );
+						buf.appendNum( (char) String );
+						buf.appendStr( field );
+						buf.appendNum( (int) str.size() + 1 );
+						buf.appendStr( str );
+						break;
+					}
+					case '{': {
+						++pos;
+						const char *start = pos;
+						if (peek( '"' )) {
+							readString( str );
+							if (isWrapper( str ) && peek( ':' )) {
+								++pos;
+								readWrapper( buf, field );
+								expect( '}' );
+								return;
+							}
+						}
+						pos = start;
+						readEmbedded( buf, Object, field, [&]() { readMembers( buf ); } );
+						break;
+					}
+					case '[':
+						++pos;
+						readEmbedded( buf, Array, field, [&]() { readElements( buf ); } );
+						break;
+					case 't':
+						if (!consume( "true" ))
+							fail( "unexpected literal" );
+						buf.appendNum( (char) Bool );
+						buf.appendStr( field );
+						buf.appendNum( (char) 1 );
+						break;
+					case 'f':
+						if (!consume( "false" ))
+							fail( "unexpected literal" );
+						buf.appendNum( (char) Bool );
+						buf.appendStr( field );
+						buf.appendNum( (char) 0 );
+						break;
+					case 'n':
+						if (!consume( "null" ))
+							fail( "unexpected literal" );
+						buf.appendNum( (char) jstNULL );
+						buf.appendStr( field );
+						break;
+					default:
+						readNumber( buf, field );
+				}
+			}
+
+			bool isDigit() const {
+				return pos < end && *pos >= '0' && *pos <= '9';
+			}
+
+			void readNumber( BufBuilder &buf, const StringData &field ) {
+				const char *start = pos;
+				bool negative = pos < end && *pos == '-';
+				if (negative)
+					++pos;
+				if (!isDigit())
+					fail( "invalid number" );
+				// Up to 19 significant digits in mantissa, the rest moves the exponent
+				unsigned long long mantissa = 0;
+				int significant = 0;
+				int exponent = 0;
+				bool integral = true;
+				for ( ; isDigit(); ++pos ) {
+					if (significant < 19) {
+						mantissa = mantissa * 10 + ( *pos - '0' );
+						if (mantissa)
+							++significant;
+					} else {
+						++significant;
+						++exponent;
+					}
+				}
+				if (pos < end && *pos == '.') {
+					integral = false;
+					++pos;
+					if (!isDigit())
+						fail( "invalid number" );
+					for ( ; isDigit(); ++pos ) {
+						if (significant < 19) {
+							mantissa = mantissa * 10 + ( *pos - '0' );
+							--exponent;
+							if (mantissa)
+								++significant;
+						}
+					}
+				}
+				if (pos < end && ( *pos == 'e' || *pos == 'E' )) {
+					integral = false;
+					++pos;
+					bool negativeExponent = pos < end && *pos == '-';
+					if (pos < end && ( *pos == '-' || *pos == '+' ))
+						++pos;
+					if (!isDigit())
+						fail( "invalid number" );
+					int e = 0;
+					for ( ; isDigit(); ++pos )
+						e = std::min( e * 10 + ( *pos - '0' ), 100000 );
+					exponent += negativeExponent ? -e : e;
+				}
+
+				if (integral && exponent == 0 && 
+						mantissa <= ( negative ? 9223372036854775808ULL : 9223372036854775807ULL )) {
+					long long l = negative ? (long long) ( 0ULL - mantissa ) : (long long) mantissa;
+					buf.appendNum( (char) ( l == (int) l ? NumberInt : NumberLong ) );
+					buf.appendStr( field );
+					if (l == (int) l)
+						buf.appendNum( (int) l );
+					else
+						buf.appendNum( l );
+					return;
+				}
+
+				double d;
+				if (mantissa < 9007199254740992ULL && exponent >= -22 && exponent <= 22) {
+					// Mantissa and power of ten are exact, so the result is correctly rounded
+					d = (double) mantissa;
+					d = exponent < 0 ? d / exactPowerOfTen( -exponent ) : d * exactPowerOfTen( exponent );
+					if (negative)
+						d = -d;
+				} else {
+					std::string number( start, pos - start );
+					d = strtod( number.c_str(), NULL );
+				}
+				buf.appendNum( (char) NumberDouble );
+				buf.appendStr( field );
+				buf.appendNum( d );
+			}
+
+			static bool isWrapper( const std::string &key ) {
+				static const char *wrappers[] = { "$oid", "$numberInt", "$numberLong",
+					"$numberDouble", "$date", "$binary", "$timestamp",
+					"$regularExpression", "$code", "$symbol", "$minKey", "$maxKey",
+					"$undefined" };
+				for ( const char *wrapper : wrappers ) {
+					if (key == wrapper)
+						return true;
+				}
+				return false;
+			}
+
+			/// Unquoted integer, as used in $date and $timestamp
+			long long readInteger() {
+				skipSpace();
+				bool negative = pos < end && *pos == '-';
+				if (negative)
+					++pos;
+				if (pos == end || *pos < '0' || *pos > '9')
+					fail( "invalid integer" );
+				long long value = 0;
+				while ( pos < end && *pos >= '0' && *pos <= '9' ) {
+					int digit = *pos++ - '0';
+					if (value > ( std::numeric_limits<long long>::max() - digit ) / 10)
+						fail( "integer out of range" );
+					value = value * 10 + digit;
+				}
+				return negative ? -value : value;
+			}
+
+			/// Quoted integer of a wrapper like {"$numberInt": "1"}, checked against [min, max]
+			long long parseInteger( const std::string &value, long long min, long long max ) {
+				if (value.empty())
+					fail( "invalid integer" );
+				char *valueEnd;
+				errno = 0;
+				long long result = strtoll( value.c_str(), &valueEnd, 10 );
+				if (*valueEnd != '\0')
+					fail( "invalid integer" );
+				if (errno == ERANGE || result < min || result > max)
+					fail( "integer out of range" );
+				return result;
+			}
+
+			/// Quoted number of {"$numberDouble": "1.5"}, other than NaN and Infinity
+			double parseDouble( const std::string &value ) {
+				if (value.empty())
+					fail( "invalid $numberDouble" );
+				// Overflow results in infinity, underflow in a (sub)normal value
+				char *valueEnd;
+				double result = strtod( value.c_str(), &valueEnd );
+				if (*valueEnd != '\0' || std::isnan( result ) || std::isinf( result ))
+					fail( "invalid $numberDouble" );
+				return result;
+			}
+
+			/// One or two hex digits, as used in the subType of $binary
+			int parseSubType( const std::string &value ) {
+				if (value.empty() || value.size() > 2)
+					fail( "invalid $binary subType" );
+				int result = 0;
+				for ( char c : value )
+					result = result * 16 + hexValue( c );
+				return result;
+			}
+
+			/// Fixed width decimal field of an ISO-8601 date
+			int dateDigits( const std::string &value, size_t &i, size_t width ) {
+				int result = 0;
+				for ( size_t last = i + width; i < last; ++i ) {
+					if (i >= value.size() || value[i] < '0' || value[i] > '9')
+						fail( "invalid $date" );
+					result = result * 10 + ( value[i] - '0' );
+				}
+				return result;
+			}
+
+			void dateSeparator( const std::string &value, size_t &i, char c ) {
+				if (i >= value.size() || value[i] != c)
+					fail( "invalid $date" );
+				++i;
+			}
+
+			/// Milliseconds since the epoch of an ISO-8601 date, e.g. 1970-01-01T00:00:00.000Z
+			long long parseIsoDate( const std::string &value ) {
+				size_t i = 0;
+				int year = dateDigits( value, i, 4 );
+				dateSeparator( value, i, '-' );
+				int month = dateDigits( value, i, 2 );
+				dateSeparator( value, i, '-' );
+				int day = dateDigits( value, i, 2 );
+				dateSeparator( value, i, 'T' );
+				int hour = dateDigits( value, i, 2 );
+				dateSeparator( value, i, ':' );
+				int minute = dateDigits( value, i, 2 );
+				dateSeparator( value, i, ':' );
+				int second = dateDigits( value, i, 2 );
+				int millis = 0;
+				if (i < value.size() && value[i] == '.') {
+					++i;
+					int scale = 100;
+					if (i >= value.size() || value[i] < '0' || value[i] > '9')
+						fail( "invalid $date" );
+					// Digits beyond milliseconds are dropped
+					for ( ; i < value.size() && value[i] >= '0' && value[i] <= '9'; ++i ) {
+						millis += ( value[i] - '0' ) * scale;
+						scale /= 10;
+					}
+				}
+				int offset = 0;
+				if (i < value.size() && value[i] == 'Z') {
+					++i;
+				} else if (i < value.size() && ( value[i] == '+' || value[i] == '-' )) {
+					int sign = value[i++] == '-' ? -1 : 1;
+					int offsetHours = dateDigits( value, i, 2 );
+					if (i < value.size() && value[i] == ':')
+						++i;
+					offset = sign * ( offsetHours * 60 + dateDigits( value, i, 2 ) );
+				} else
+					fail( "invalid $date" );
+				if (i != value.size() || month < 1 || month > 12 || day < 1 || day > 31
+						|| hour > 23 || minute > 59 || second > 60)
+					fail( "invalid $date" );
+
+				// Days since 1970-01-01 in the proleptic Gregorian calendar
+				int y = year - ( month <= 2 );
+				int era = ( y >= 0 ? y : y - 399 ) / 400;
+				int yearOfEra = y - era * 400;
+				int dayOfYear = ( 153 * ( month + ( month > 2 ? -3 : 9 ) ) + 2 ) / 5 + day - 1;
+				int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+				long long days = era * 146097LL + dayOfEra - 719468;
+				long long seconds = days * 86400 + hour * 3600 + ( minute - offset ) * 60 + second;
+				return seconds * 1000 + millis;
+			}
+
+			/// Members of a wrapper object like {"t": 1, "i": 2}, calls readMember( name )
+			template<class F>
+				void readWrapperMembers( F readMember ) {
+					std::string member;
+					expect( '{' );
+					for (;;) {
+						skipSpace();
+						readString( member );
+						expect( ':' );
+						readMember( member );
+						if (!peek( ',' ))
+							break;
+						++pos;
+					}
+					expect( '}' );
+				}
+
+			/// Quoted string content of a wrapper, e.g. the "1" in {"$numberLong": "1"}
+			const std::string &wrappedString() {
+				skipSpace();
+				readString( str );
+				return str;
+			}
+
+			/// Extended JSON type wrapper (see isWrapper), after {"$name":
+			void readWrapper( BufBuilder &buf, const StringData &field ) {
+				std::string key = str;
+				if (key == "$oid") {
+					const std::string &hex = wrappedString();
+					if (hex.size() != 24)
+						fail( "invalid $oid" );
+					buf.appendNum( (char) jstOID );
+					buf.appendStr( field );
+					for ( size_t i = 0; i < 24; i += 2 )
+						buf.appendNum( (char) ( hexValue( hex[i] ) << 4 | hexValue( hex[i+1] ) ) );
+				} else if (key == "$numberInt") {
+					buf.appendNum( (char) NumberInt );
+					buf.appendStr( field );
+					buf.appendNum( (int) parseInteger( wrappedString(),
+								std::numeric_limits<int>::min(), std::numeric_limits<int>::max() ) );
+				} else if (key == "$numberLong") {
+					buf.appendNum( (char) NumberLong );
+					buf.appendStr( field );
+					buf.appendNum( parseInteger( wrappedString(),
+								std::numeric_limits<long long>::min(),
+								std::numeric_limits<long long>::max() ) );
+				} else if (key == "$numberDouble") {
+					const std::string &value = wrappedString();
+					double d;
+					if (value == "NaN")
+						d = std::numeric_limits<double>::quiet_NaN();
+					else if (value == "Infinity")
+						d = std::numeric_limits<double>::infinity();
+					else if (value == "-Infinity")
+						d = -std::numeric_limits<double>::infinity();
+					else
+						d = parseDouble( value );
+					buf.appendNum( (char) NumberDouble );
+					buf.appendStr( field );
+					buf.appendNum( d );
+				} else if (key == "$date") {
+					long long millis;
+					if (peek( '{' )) {
+						readWrapperMembers( [&]( const std::string &member ) {
+								if (member != "$numberLong")
+									fail( "invalid $date" );
+								millis = parseInteger( wrappedString(),
+										std::numeric_limits<long long>::min(),
+										std::numeric_limits<long long>::max() );
+							} );
+					} else if (peek( '"' )) {
+						millis = parseIsoDate( wrappedString() );
+					} else {
+						millis = readInteger();
+					}
+					buf.appendNum( (char) Date );
+					buf.appendStr( field );
+					buf.appendNum( millis );
+				} else if (key == "$binary") {
+					std::string data, subType;
+					readWrapperMembers( [&]( const std::string &member ) {
+							if (member == "base64")
+								data = wrappedString();
+							else if (member == "subType")
+								subType = wrappedString();
+							else
+								fail( "invalid $binary" );
+						} );
+					std::string decoded = fromBase64( data );
+					buf.appendNum( (char) BinData );
+					buf.appendStr( field );
+					buf.appendNum( (int) decoded.size() );
+					buf.appendNum( (char) parseSubType( subType ) );
+					buf.appendBuf( decoded.data(), decoded.size() );
+				} else if (key == "$timestamp") {
+					unsigned int time = 0, increment = 0;
+					readWrapperMembers( [&]( const std::string &member ) {
+							long long integer = readInteger();
+							if (integer < 0 || integer > std::numeric_limits<unsigned int>::max())
+								fail( "$timestamp out of range" );
+							unsigned int value = (unsigned int) integer;
+							if (member == "t")
+								time = value;
+							else if (member == "i")
+								increment = value;
+							else
+								fail( "invalid $timestamp" );
+						} );
+					buf.appendNum( (char) Timestamp );
+					buf.appendStr( field );
+					buf.appendNum( increment );
+					buf.appendNum( time );
+				} else if (key == "$regularExpression") {
+					std::string pattern, options;
+					readWrapperMembers( [&]( const std::string &member ) {
+							if (member == "pattern")
+								pattern = wrappedString();
+							else if (member == "options")
+								options = wrappedString();
+							else
+								fail( "invalid $regularExpression" );
+						} );
+					buf.appendNum( (char) RegEx );
+					buf.appendStr( field );
+					buf.appendStr( pattern );
+					buf.appendStr( options );
+				} else if (key == "$code" || key == "$symbol") {
+					const std::string &value = wrappedString();
+					buf.appendNum( (char) ( key == "$code" ? Code : Symbol ) );
+					buf.appendStr( field );
+					buf.appendNum( (int) value.size() + 1 );
+					buf.appendStr( value );
+				} else if (key == "$minKey" || key == "$maxKey" || key == "$undefined") {
+					skipSpace();
+					if (!consume( "1" ) && !consume( "true" ))
+						fail( "invalid type wrapper" );
+					buf.appendNum( (char) ( key == "$minKey" ? MinKey :
+								( key == "$maxKey" ? MaxKey : Undefined ) ) );
+					buf.appendStr( field );
+				}
+			}
+
+			int hexValue( char c ) {
+				if (c >= '0' && c <= '9')
+					return c - '0';
+				if (c >= 'a' && c <= 'f')
+					return c - 'a' + 10;
+				if (c >= 'A' && c <= 'F')
+					return c - 'A' + 10;
+				fail( "invalid hex digit" );
+				return 0;
+			}
+
+			std::string fromBase64( const std::string &data ) {
+				std::string decoded;
+				unsigned int v = 0;
+				int bits = 0;
+				for ( char c : data ) {
+					int d;
+					if (c >= 'A' && c <= 'Z') d = c - 'A';
+					else if (c >= 'a' && c <= 'z') d = c - 'a' + 26;
+					else if (c >= '0' && c <= '9') d = c - '0' + 52;
+					else if (c == '+') d = 62;
+					else if (c == '/') d = 63;
+					else if (c == '=') break;
+					else {
+						fail( "invalid base64" );
+						return decoded;
+					}
+					v = ( v << 6 ) | d;
+					bits += 6;
+					if (bits >= 8) {
+						bits -= 8;
+						decoded.push_back( (char) ( ( v >> bits ) & 0xff ) );
+					}
+				}
+				return decoded;
+			}
+
+			void appendUtf8( std::string &s, unsigned int code ) {
+				if (code < 0x80) {
+					s.push_back( (char) code );
+				} else if (code < 0x800) {
+					s.push_back( (char) ( 0xc0 | ( code >> 6 ) ) );
+					s.push_back( (char) ( 0x80 | ( code & 0x3f ) ) );
+				} else if (code < 0x10000) {
+					s.push_back( (char) ( 0xe0 | ( code >> 12 ) ) );
+					s.push_back( (char) ( 0x80 | ( ( code >> 6 ) & 0x3f ) ) );
+					s.push_back( (char) ( 0x80 | ( code & 0x3f ) ) );
+				} else {
+					s.push_back( (char) ( 0xf0 | ( code >> 18 ) ) );
+					s.push_back( (char) ( 0x80 | ( ( code >> 12 ) & 0x3f ) ) );
+					s.push_back( (char) ( 0x80 | ( ( code >> 6 ) & 0x3f ) ) );
+					s.push_back( (char) ( 0x80 | ( code & 0x3f ) ) );
+				}
+			}
+
+			unsigned int readHex4() {
+				if (end - pos < 4)
+					fail( "invalid unicode escape" );
+				unsigned int code = 0;
+				for ( int i = 0; i < 4; ++i )
+					code = ( code << 4 ) | hexValue( *pos++ );
+				return code;
+			}
+
+			/// Read a quoted string into s, reusing its buffer
+			void readString( std::string &s ) {
+				expect( '"' );
+				s.clear();
+				for (;;) {
+					const char *start = pos;
+					while ( pos < end && *pos != '"' && *pos != '\\' )
+						++pos;
+					s.append( start, pos - start );
+					if (pos == end)
+						fail( "unterminated string" );
+					if (*pos++ == '"')
+						return;
+					if (pos == end)
+						fail( "unterminated string" );
+					char c = *pos++;
+					switch ( c ) {
+						case '"': case '\\': case '/': s.push_back( c ); break;
+						case 'b': s.push_back( '\b' ); break;
+						case 'f': s.push_back( '\f' ); break;
+						case 'n': s.push_back( '\n' ); break;
+						case 'r': s.push_back( '\r' ); break;
+						case 't': s.push_back( '\t' ); break;
+						case 'u': {
+							unsigned int code = readHex4();
+							if (code >= 0xd800 && code < 0xdc00 && consume( "\\u" )) {
+								unsigned int low = readHex4();
+								code = 0x10000 + ( ( code - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+							}
+							appendUtf8( s, code );
+							break;
+						}
+						default:
+							fail( "invalid escape" );
+					}
+				}
+			}
+
+			const char *pos;
+			const char *end;
+			// Scratch buffers reused between strings
+			std::string name;
+			std::string str;
+	};
+
+	ExtJSONWriter &operator<<( ExtJSONWriter &writer, const BSONObj &bobj );
+	inline ExtJSONWriter &operator<<( ExtJSONWriter &writer, const BSONObj &bobj ) {
+		writer.write( bobj );
+		return writer;
+	}
+
+	template<class T>
+		ExtJSONWriter &operator<<( ExtJSONWriter &writer, const T &t ) {
+			mongo::BSONEmitter emit;
+			emit << t;
+			writer.write( emit.obj() );
+			return writer;
+		}
+};
+
+#endif
@@ -0,0 +1,353 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_POOL_H
+#define BSON_POOL_H
+#include<algorithm>
+#include<atomic>
+#include<mutex>
+#include<vector>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief Thread safe pool of emitter buffers
+	 *
+	 * Each thread keeps a few idle buffers in a thread local cache. Buffers
+	 * that do not fit in that cache go to a global pool of fixed size, which
+	 * is shared between threads without locking. Buffers released by one
+	 * thread can thereby be reused by another.
+	 *
+	 * All idle buffers together, in the global pool and in the thread
+	 * caches, hold at most maxBytes. A thread cache reserves a share of
+	 * maxBytes / threadShare from this budget once, and then acquires and
+	 * releases buffers within that share without touching shared state.
+	 * Larger buffers always go to the global pool, where any thread can
+	 * pick them up. A thread returns its share when it exits, or when
+	 * setMaxBytes() lowers the limit. stats() sums the counters of all
+	 * threads.
+	 */
+	class BSONBufferPool {
+		public:
+			struct Stats {
+				/// Buffers acquired from the pool
+				unsigned long long hits;
+				/// Buffers that had to be allocated
+				unsigned long long misses;
+				/// Released buffers that were freed, because the pool was full
+				unsigned long long drops;
+				/// Bytes held by idle buffers
+				long long bytesHeld;
+			};
+
+			/// Share of maxBytes a single thread cache can hold is 1/threadShare
+			static const int threadShare = 16;
+
+			static BSONBufferPool &instance() {
+				static BSONBufferPool pool;
+				return pool;
+			}
+
+			BufBuilder *acquire() {
+				ThreadCache &cache = threadCache();
+				BufBuilder *buf = cache.pop();
+				if (!buf)
+					buf = popGlobal();
+				if (!buf) {
+					increment( cache.misses );
+					return new BufBuilder();
+				}
+				increment( cache.hits );
+				buf->reset();
+				return buf;
+			}
+
+			/// Return a buffer to the pool, can be called from any thread
+			void release( BufBuilder *buf ) {
+				ThreadCache &cache = threadCache();
+				if (!cache.push( buf ))
+					pushGlobal( buf, cache );
+			}
+
+			/// Buffers pooled before the limit was lowered stay until they are acquired
+			void setMaxBytes( long long bytes ) {
+				maxBytes.store( bytes, std::memory_order_relaxed );
+			}
+
+			Stats stats() const {
+				std::lock_guard<std::mutex> lock( threadsMutex );
+				Stats s = retired;
+				long long leases = 0;
+				for ( auto cache : threads ) {
+					s.hits += cache->hits.load( std::memory_order_relaxed );
+					s.misses += cache->misses.load( std::memory_order_relaxed );
+					s.drops += cache->drops.load( std::memory_order_relaxed );
+					s.bytesHeld += cache->bytes.load( std::memory_order_relaxed );
+					leases += cache->lease.load( std::memory_order_relaxed );
+				}
+				s.bytesHeld += reserved.load( std::memory_order_relaxed ) - leases;
+				return s;
+			}
+
+		protected:
+			static const int globalSlots = 64;
+			static const int threadSlots = 4;
+
+			/// Counter written by a single thread, no read-modify-write needed
+			template<class C>
+				static void increment( std::atomic<C> &counter ) {
+					counter.store( counter.load( std::memory_order_relaxed ) + 1,
+							std::memory_order_relaxed );
+				}
+
+			struct ThreadCache {
+				ThreadCache( BSONBufferPool *pool ) : pool( pool ), count( 0 ), 
+					hits( 0 ), misses( 0 ), drops( 0 ), bytes( 0 ), lease( 0 ) {
+					std::lock_guard<std::mutex> lock( pool->threadsMutex );
+					pool->threads.push_back( this );
+				}
+
+				~ThreadCache() {
+					// Hand idle buffers to the other threads when this one exits
+					pool->reserved.fetch_sub( lease.load( std::memory_order_relaxed ),
+							std::memory_order_relaxed );
+					lease.store( 0, std::memory_order_relaxed );
+					while ( count ) {
+						BufBuilder *buf = pop();
+						pool->pushGlobal( buf, *this );
+					}
+					std::lock_guard<std::mutex> lock( pool->threadsMutex );
+					pool->retired.hits += hits.load( std::memory_order_relaxed );
+					pool->retired.misses += misses.load( std::memory_order_relaxed );
+					pool->retired.drops += drops.load( std::memory_order_relaxed );
+					pool->threads.erase( std::find( pool->threads.begin(),
+								pool->threads.end(), this ) );
+				}
+
+				BufBuilder *pop() {
+					if (!count)
+						return NULL;
+					BufBuilder *buf = buffers[--count];
+					bytes.store( bytes.load( std::memory_order_relaxed ) - buf->getSize(),
+							std::memory_order_relaxed );
+					return buf;
+				}
+
+				bool push( BufBuilder *buf ) {
+					long long share = pool->maxBytes.load( std::memory_order_relaxed ) / threadShare;
+					long long held = bytes.load( std::memory_order_relaxed );
+					long long leased = lease.load( std::memory_order_relaxed );
+					// Only when the limit changed, or on the first release in this thread
+					if (leased != share)
+						leased = renewLease( share, held );
+					if (count == threadSlots || held + buf->getSize() > leased)
+						return false;
+					buffers[count++] = buf;
+					bytes.store( held + buf->getSize(), std::memory_order_relaxed );
+					return true;
+				}
+
+				/// Reserve share bytes of the pool budget, or give back what is above it
+				long long renewLease( long long share, long long held ) {
+					long long leased = lease.load( std::memory_order_relaxed );
+					if (leased > share) {
+						// Keep the bytes of buffers already cached, they are released on pop
+						long long keep = std::max( share, held );
+						if (keep < leased)
+							pool->reserved.fetch_sub( leased - keep, std::memory_order_relaxed );
+						leased = keep;
+					} else if (pool->reserve( share - leased ))
+						leased = share;
+					lease.store( leased, std::memory_order_relaxed );
+					return leased;
+				}
+
+				BSONBufferPool *pool;
+				int count;
+				BufBuilder *buffers[threadSlots];
+				std::atomic<unsigned long long> hits;
+				std::atomic<unsigned long long> misses;
+				std::atomic<unsigned long long> drops;
+				/// Bytes held by the buffers in this cache
+				std::atomic<long long> bytes;
+				/// Bytes of the pool budget reserved for this cache
+				std::atomic<long long> lease;
+			};
+
+			BSONBufferPool() : reserved( 0 ), maxBytes( 64*1024*1024 ) {
+				for ( int i = 0; i < globalSlots; ++i )
+					global[i].store( NULL );
+				retired.hits = 0;
+				retired.misses = 0;
+				retired.drops = 0;
+				retired.bytesHeld = 0;
+			}
+
+			~BSONBufferPool() {
+				for ( int i = 0; i < globalSlots; ++i )
+					delete global[i].exchange( NULL );
+			}
+
+			ThreadCache &threadCache() {
+				static thread_local ThreadCache cache( this );
+				return cache;
+			}
+
+			/// Take size bytes from the budget, fails when that would exceed maxBytes
+			bool reserve( long long size ) {
+				long long held = reserved.load( std::memory_order_relaxed );
+				do {
+					if (held + size > maxBytes.load( std::memory_order_relaxed ))
+						return false;
+				} while ( !reserved.compare_exchange_weak( held, held + size,
+							std::memory_order_relaxed ) );
+				return true;
+			}
+
+			BufBuilder *popGlobal() {
+				for ( int i = 0; i < globalSlots; ++i ) {
+					if (global[i].load( std::memory_order_relaxed )) {
+						BufBuilder *buf = global[i].exchange( NULL, std::memory_order_acquire );
+						if (buf) {
+							reserved.fetch_sub( buf->getSize(), std::memory_order_relaxed );
+							return buf;
+						}
+					}
+				}
+				return NULL;
+			}
+
+			/// Move an idle buffer to the global pool, or free it when the pool is full
+			void pushGlobal( BufBuilder *buf, ThreadCache &cache ) {
+				long long size = buf->getSize();
+				if (!reserve( size )) {
+					drop( buf, cache );
+					return;
+				}
+				for ( int i = 0; i < globalSlots; ++i ) {
+					BufBuilder *expected = NULL;
+					if (global[i].compare_exchange_strong( expected, buf,
+								std::memory_order_release, std::memory_order_relaxed ))
+						return;
+				}
+				reserved.fetch_sub( size, std::memory_order_relaxed );
+				drop( buf, cache );
+			}
+
+			void drop( BufBuilder *buf, ThreadCache &cache ) {
+				increment( cache.drops );
+				delete buf;
+			}
+
+			std::atomic<BufBuilder *> global[globalSlots];
+			/// Bytes of buffers in the global pool plus the leases of all thread caches
+			std::atomic<long long> reserved;
+			std::atomic<long long> maxBytes;
+
+			/// Thread caches, only used to collect stats()
+			mutable std::mutex threadsMutex;
+			std::vector<ThreadCache *> threads;
+			/// Counters of threads that have exited
+			Stats retired;
+	};
+
+	/**
+	 * \brief BSONObj whose buffer returns to the BSONBufferPool when destroyed
+	 *
+	 * obj() is only valid as long as the BSONPooledObj exists. Use
+	 * obj().getOwned() for a copy that outlives it.
+	 */
+	class BSONPooledObj {
+		public:
+			BSONPooledObj( BufBuilder *buf, const BSONObj &bobj )
+				: buf( buf ), bobj( bobj ) {}
+
+			BSONPooledObj( BSONPooledObj &&other )
+				: buf( other.buf ), bobj( other.bobj ) {
+				other.buf = NULL;
+			}
+
+			~BSONPooledObj() {
+				if (buf)
+					BSONBufferPool::instance().release( buf );
+			}
+
+			const BSONObj &obj() const {
+				return bobj;
+			}
+
+		private:
+			BSONPooledObj( const BSONPooledObj & );
+			BSONPooledObj &operator=( const BSONPooledObj & );
+
+			BufBuilder *buf;
+			BSONObj bobj;
+	};
+
+	/**
+	 * \brief Pooled buffer and the builder on top of it
+	 *
+	 * Base of BSONPooledEmitter, so that both exist before the BSONEmitter
+	 * base is constructed with a pointer to the builder.
+	 */
+	class BSONPooledBuilder {
+		protected:
+			BSONPooledBuilder()
+				: buf( BSONBufferPool::instance().acquire() ), pooledBuilder( *buf ) {}
+
+			BufBuilder *buf;
+			BSONObjBuilder pooledBuilder;
+	};
+
+	/**
+	 * \brief BSONEmitter that builds into a buffer from the BSONBufferPool
+	 *
+	 * The builder is part of the emitter, so emitting a document does not
+	 * allocate unless the pool is empty.
+	 *
+	 * \code
+	 * mongo::BSONPooledEmitter emit;
+	 * emit << t;
+	 * mongo::BSONPooledObj doc = emit.obj();
+	 * queue.push( std::move( doc ) ); // Released by the consumer thread
+	 * \endcode
+	 */
+	class BSONPooledEmitter : private BSONPooledBuilder, public BSONEmitter {
+		public:
+			BSONPooledEmitter() : BSONPooledBuilder(), BSONEmitter( &pooledBuilder ) {}
+
+			~BSONPooledEmitter() {
+				if (buf) {
+					// Finish the builder first, it writes to buf when destroyed otherwise
+					pooledBuilder.done();
+					BSONBufferPool::instance().release( buf );
+				}
+			}
+
+			BSONPooledObj obj() {
+				BSONPooledObj pooled( buf, pooledBuilder.done() );
+				builder = NULL;
+				buf = NULL;
+				return pooled;
+			}
+
+		private:
+			BSONPooledEmitter( const BSONPooledEmitter & );
+			BSONPooledEmitter &operator=( const BSONPooledEmitter & );
+	};
+};
+
+#endif
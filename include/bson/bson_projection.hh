@@ -0,0 +1,143 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_PROJECTION_H
+#define BSON_PROJECTION_H
+#include<cstdint>
+#include<cstring>
+#include<functional>
+#include<string>
+#include<vector>
+#include "bson/bson_stream.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief Decode a selected set of (dotted) field paths in a single pass
+	 *
+	 * Fields that are not part of the projection, including large embedded
+	 * objects and arrays, are jumped over using their length prefix. Only
+	 * the embedded objects on the path to a requested field are descended
+	 * into, and decoding stops as soon as all requested fields are found.
+	 * Fields missing from the object leave their target untouched. Adding
+	 * the same path more than once decodes the field into every target.
+	 *
+	 * \code
+	 * mongo::BSONProjection proj;
+	 * proj.add( "name", t.name ).add( "stats.p99", t.p99 );
+	 * bobj >> proj;
+	 * \endcode
+	 */
+	class BSONProjection {
+		public:
+			BSONProjection() {}
+
+			template<class T>
+				BSONProjection &add( const std::string &path, T &t ) {
+					Node *node = &root;
+					size_t start = 0;
+					for (;;) {
+						size_t dot = path.find( '.', start );
+						node = &node->child( path.substr( start, dot - start ) );
+						if (dot == std::string::npos)
+							break;
+						start = dot + 1;
+					}
+					T *pT = &t;
+					if (node->target) {
+						auto previous = node->target;
+						node->target = [previous, pT]( const BSONElement &bel ) {
+							previous( bel );
+							bel >> *pT;
+						};
+					} else
+						node->target = [pT]( const BSONElement &bel ) { bel >> *pT; };
+					return *this;
+				}
+
+			void decode( const BSONObj &bobj ) const {
+				decode( bobj.objdata(), root );
+			}
+
+		protected:
+			struct Node {
+				std::string name;
+				std::function<void( const BSONElement & )> target;
+				std::vector<Node> children;
+
+				Node &child( const std::string &childName ) {
+					for ( auto &node : children ) {
+						if (node.name == childName)
+							return node;
+					}
+					children.push_back( Node() );
+					children.back().name = childName;
+					return children.back();
+				}
+
+				const Node *find( const char *childName ) const {
+					for ( auto &node : children ) {
+						if (strcmp( node.name.c_str(), childName ) == 0)
+							return &node;
+					}
+					return NULL;
+				}
+			};
+
+			static void decode( const char *objdata, const Node &node ) {
+				int objsize;
+				memcpy( &objsize, objdata, sizeof( int ) );
+				const char *end = objdata + objsize - 1;
+				const char *pos = objdata + sizeof( int );
+				// One bit per matched child, so a key that occurs twice in the
+				// document is not counted twice. With more than 64 children
+				// the whole object is scanned.
+				const size_t nChildren = node.children.size();
+				const uint64_t all = nChildren >= 64 ? ~uint64_t( 0 )
+					: ( uint64_t( 1 ) << nChildren ) - 1;
+				uint64_t matched = 0;
+				while ( pos < end && ( nChildren > 64 || matched != all ) ) {
+					BSONElement bel( pos );
+					const Node *child = node.find( bel.fieldName() );
+					if (child) {
+						size_t index = child - &node.children[0];
+						if (index < 64)
+							matched |= uint64_t( 1 ) << index;
+						if (child->target)
+							child->target( bel );
+						if (!child->children.empty() && bel.isABSONObj())
+							decode( bel.value(), *child );
+					}
+					// For embedded objects and arrays size() only reads the
+					// length prefix, so unneeded subtrees are never walked
+					pos += bel.size();
+				}
+			}
+
+			Node root;
+	};
+
+	void operator>>( const BSONObj &bobj, BSONProjection &proj );
+	inline void operator>>( const BSONObj &bobj, BSONProjection &proj ) {
+		proj.decode( bobj );
+	}
+
+	void operator>>( const BSONElement &bel, BSONProjection &proj );
+	inline void operator>>( const BSONElement &bel, BSONProjection &proj ) {
+		proj.decode( bel.Obj() );
+	}
+};
+
+#endif
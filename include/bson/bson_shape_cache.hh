@@ -0,0 +1,298 @@
+/* Copyright 2013 Edwin van Leeuwen.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef BSON_SHAPE_CACHE_H
+#define BSON_SHAPE_CACHE_H
+#include<atomic>
+#include<cstdint>
+#include<cstring>
+#include<string>
+#include<vector>
+#include "bson/bson_projection.hh"
+
+namespace mongo {
+
+	/**
+	 * \brief Layout of the leading top level fields of a document
+	 *
+	 * Records the offset, type and name of every top level field up to the
+	 * last field of a projection, and the length prefix of fields with a
+	 * variable size. A document with the same bytes at these places has
+	 * these fields at exactly the same offsets.
+	 */
+	class BSONShape {
+		public:
+			BSONShape() : minSize( 0 ) {}
+
+			bool matches( const char *objdata ) const {
+				int objsize;
+				memcpy( &objsize, objdata, sizeof( int ) );
+				if (objsize < minSize)
+					return false;
+				const char *header = headers.data();
+				for ( auto &field : fields ) {
+					if (memcmp( objdata + field.offset, header, field.headerSize ) != 0)
+						return false;
+					if (field.checkSize && memcmp( objdata + field.offset + field.headerSize,
+								&field.sizePrefix, sizeof( int ) ) != 0)
+						return false;
+					header += field.headerSize;
+				}
+				return true;
+			}
+
+			struct Field {
+				int offset;
+				int headerSize;
+				int sizePrefix;
+				bool checkSize;
+			};
+
+			int minSize;
+			/// Type byte and field name of every field, back to back
+			std::string headers;
+			std::vector<Field> fields;
+	};
+
+	/**
+	 * \brief Projection that caches the document layout per decoded type
+	 *
+	 * The first suitable document decoded with a BSONCachedProjection<T>
+	 * teaches the layout of its leading fields (see BSONShape). Later
+	 * documents that match this layout are decoded straight from the cached
+	 * offsets, other documents fall back to the general BSONProjection
+	 * decoding. Once published the layout is read from multiple threads
+	 * without locking.
+	 *
+	 * Only layouts that contain all requested fields are published. When a
+	 * document is missing one of them, or has a regular expression in front
+	 * of them, the next document is tried, up to maxLearnAttempts documents.
+	 *
+	 * Every projection instance maps the cached fields to its own targets
+	 * by name, once per published layout, so projections for the same T
+	 * with different paths can share the layout. A projection that requests
+	 * a field outside of the cached layout always uses the general
+	 * decoding. After that, a document costs the layout check and a direct
+	 * call per requested field. The shared layout is thread safe, a
+	 * projection instance is not.
+	 *
+	 * Variable sized fields (strings, embedded objects) in front of a
+	 * requested field only match when their size is the same, so they are
+	 * best kept at the end of a document.
+	 *
+	 * \code
+	 * friend void operator>>( const mongo::BSONElement &bel, metric &m ) {
+	 *     mongo::BSONCachedProjection<metric> proj;
+	 *     proj.add( "count", m.count ).add( "mean", m.mean );
+	 *     bel >> proj;
+	 * }
+	 * \endcode
+	 *
+	 * Setting up the projection allocates its nodes, names and targets, and
+	 * mapping the layout to them costs more than a general decode. As in the
+	 * example above this happens for every document. On a hot path, build
+	 * the projection once for a long lived target and reuse it:
+	 *
+	 * \code
+	 * metric m;
+	 * mongo::BSONCachedProjection<metric> proj;
+	 * proj.add( "count", m.count ).add( "mean", m.mean );
+	 * while ( cursor->more() ) {
+	 *     cursor->next() >> proj;
+	 *     process( m );
+	 * }
+	 * \endcode
+	 */
+	template<class T>
+		class BSONCachedProjection : public BSONProjection {
+			public:
+				/// Number of documents tried before giving up on learning a layout
+				static const int maxLearnAttempts = 16;
+
+				BSONCachedProjection() : resolved( NULL ), covered( false ) {}
+
+				/// The copy maps the layout to its own nodes again
+				BSONCachedProjection( const BSONCachedProjection &other )
+					: BSONProjection( other ), resolved( NULL ), covered( false ) {}
+
+				BSONCachedProjection &operator=( const BSONCachedProjection &other ) {
+					BSONProjection::operator=( other );
+					resolved = NULL;
+					return *this;
+				}
+
+				template<class U>
+					BSONCachedProjection &add( const std::string &path, U &u ) {
+						BSONProjection::add( path, u );
+						// Nodes may have moved and the requested fields changed
+						resolved = NULL;
+						return *this;
+					}
+
+				void decode( const BSONObj &bobj ) const {
+					const char *objdata = bobj.objdata();
+					const BSONShape *shape = cache().shape.load( std::memory_order_acquire );
+					if (!shape && cache().attempts.load( std::memory_order_relaxed ) 
+							< maxLearnAttempts)
+						shape = learn( objdata );
+					if (shape && shape != resolved)
+						resolve( shape );
+					if (!shape || !covered || !shape->matches( objdata )) {
+						BSONProjection::decode( bobj );
+						return;
+					}
+					for ( auto &step : steps ) {
+						BSONElement bel( objdata + step.offset );
+						if (step.child->target)
+							step.child->target( bel );
+						if (!step.child->children.empty() && bel.isABSONObj())
+							BSONProjection::decode( bel.value(), *step.child );
+					}
+				}
+
+			protected:
+				/// A cached field that is part of this projection
+				struct Step {
+					int offset;
+					const Node *child;
+				};
+
+				/// Map the fields of shape to the nodes of this projection
+				void resolve( const BSONShape *shape ) const {
+					steps.clear();
+					covered = false;
+					resolved = shape;
+					const size_t nChildren = root.children.size();
+					if (nChildren == 0 || nChildren > 64)
+						return;
+					const uint64_t all = nChildren == 64 ? ~uint64_t( 0 )
+						: ( uint64_t( 1 ) << nChildren ) - 1;
+					uint64_t matched = 0;
+					const char *header = shape->headers.data();
+					for ( auto &field : shape->fields ) {
+						const Node *child = root.find( header + 1 );
+						header += field.headerSize;
+						if (!child)
+							continue;
+						matched |= uint64_t( 1 ) << ( child - &root.children[0] );
+						Step step = { field.offset, child };
+						steps.push_back( step );
+					}
+					covered = matched == all;
+				}
+
+				struct Cache {
+					Cache() : shape( NULL ), attempts( 0 ) {}
+					~Cache() { delete shape.load(); }
+					std::atomic<const BSONShape *> shape;
+					std::atomic<int> attempts;
+				};
+
+				static Cache &cache() {
+					static Cache typeCache;
+					return typeCache;
+				}
+
+				static bool fixedSize( BSONType type ) {
+					switch ( type ) {
+						case String:
+						case Object:
+						case Array:
+						case BinData:
+						case RegEx:
+						case DBRef:
+						case Code:
+						case Symbol:
+						case CodeWScope:
+							return false;
+						default:
+							return true;
+					}
+				}
+
+				/**
+				 * \brief Learn the shape from objdata and publish it
+				 *
+				 * Returns NULL when objdata can not be cached. When another
+				 * thread published a shape first, that shape is returned.
+				 */
+				const BSONShape *learn( const char *objdata ) const {
+					const size_t nChildren = root.children.size();
+					if (nChildren == 0 || nChildren > 64)
+						return NULL;
+					const uint64_t all = nChildren == 64 ? ~uint64_t( 0 )
+						: ( uint64_t( 1 ) << nChildren ) - 1;
+					uint64_t matched = 0;
+					bool cacheable = true;
+
+					BSONShape *shape = new BSONShape();
+					int objsize;
+					memcpy( &objsize, objdata, sizeof( int ) );
+					const char *end = objdata + objsize - 1;
+					const char *pos = objdata + sizeof( int );
+					while ( pos < end && matched != all ) {
+						BSONElement bel( pos );
+						BSONShape::Field field;
+						field.offset = pos - objdata;
+						field.headerSize = bel.fieldNameSize() + 1;
+						field.checkSize = !fixedSize( bel.type() );
+						if (bel.type() == RegEx) // Variable size without a length prefix
+							cacheable = false;
+						else if (field.checkSize)
+							memcpy( &field.sizePrefix, bel.value(), sizeof( int ) );
+						shape->headers.append( pos, field.headerSize );
+						shape->fields.push_back( field );
+
+						const Node *child = root.find( bel.fieldName() );
+						if (child)
+							matched |= uint64_t( 1 ) << ( child - &root.children[0] );
+						pos += bel.size();
+					}
+					// Offsets of requested fields do not depend on the size of the last one
+					if (!shape->fields.empty())
+						shape->fields.back().checkSize = false;
+					shape->minSize = pos - objdata + 1;
+
+					if (!cacheable || matched != all) {
+						delete shape;
+						cache().attempts.fetch_add( 1, std::memory_order_relaxed );
+						return NULL;
+					}
+
+					const BSONShape *expected = NULL;
+					if (cache().shape.compare_exchange_strong( expected, shape,
+								std::memory_order_acq_rel ))
+						return shape;
+					delete shape;
+					return expected;
+				}
+
+				mutable const BSONShape *resolved;
+				mutable bool covered;
+				mutable std::vector<Step> steps;
+		};
+
+	template<class T>
+		void operator>>( const BSONObj &bobj, BSONCachedProjection<T> &proj ) {
+			proj.decode( bobj );
+		}
+
+	template<class T>
+		void operator>>( const BSONElement &bel, BSONCachedProjection<T> &proj ) {
+			proj.decode( bel.Obj() );
+		}
+};
+
+#endif
@@ -15,7 +15,13 @@
 
 #ifndef BSON_STREAM_H
 #define BSON_STREAM_H
+#include<algorithm>
+#include<cstdio>
+#include<cstring>
+#include<limits>
 #include<map>
+#include<unordered_map>
+#include<unordered_set>
 #include "bson/bson.h"
 
 namespace mongo {
@@ -91,6 +97,17 @@ void operator>>( const mongo::BSONElement &bel, std::set<T> &v ) {
 	}
 }
 
+template<class T>
+void operator>>( const mongo::BSONElement &bel, std::unordered_set<T> &v ) {
+	v.clear();
+	auto barr = bel.Array();
+	for ( auto & bson_el : barr ) {
+		T el;
+		bson_el >> el;
+		v.insert( el );
+	}
+}
+
 template<class K, class V>
 void operator>>( const mongo::BSONElement &bel, std::pair<K,V> &p ) {
 	auto barr = bel.Array();
@@ -109,6 +126,17 @@ void operator>>( const mongo::BSONElement &bel, std::map<K,V> &map ) {
 	}
 }
 
+template<class K, class V>
+void operator>>( const mongo::BSONElement &bel, std::unordered_map<K,V> &map ) {
+	map.clear();
+	auto barr = bel.Array();
+	for ( auto & bson_el : barr ) {
+		std::pair<K,V> el;
+		bson_el >> el;
+		map.insert( el );
+	}
+}
+
 	
 template<class V>
 void operator>>( const mongo::BSONObj &bobj, std::map<char *,V> &map ) {
@@ -132,6 +160,17 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 	}
 }
 
+template<class V>
+void operator>>( const mongo::BSONObj &bobj, std::unordered_map<std::string,V> &map ) {
+	map.clear();
+	for ( mongo::BSONObj::iterator i = bobj.begin(); i.more(); ) {
+		mongo::BSONElement el = i.next();
+		V value;
+		el >> value;
+		map[el.fieldName()] = value;
+	}
+}
+
 	class BSONEmitter;
 
 	class BSONValueEmitter {
@@ -156,6 +195,10 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 				builder.endField( name );
 			}
 
+			/// Start a sub object/array for the current field in the parent buffer
+			BufBuilder &subobjStart();
+			BufBuilder &subarrayStart();
+
 			BSONEmitter *pEmitter;
 			BSONObjBuilderValueStream builder;
 		protected:
@@ -184,7 +227,7 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 			}
 
 			BSONValueEmitter &append( const std::string &name ) {
-				v_emitter.builder.endField( name.c_str() );
+				v_emitter.endField( name.c_str() );
 				return v_emitter;
 			}
 
@@ -202,11 +245,23 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 		: pEmitter( pEmitter ), builder( pEmitter->builder ) {
 		}
 
+	inline BufBuilder &BSONValueEmitter::subobjStart() {
+		return pEmitter->builder->subobjStart( fieldName );
+	}
+
+	inline BufBuilder &BSONValueEmitter::subarrayStart() {
+		return pEmitter->builder->subarrayStart( fieldName );
+	}
+
 	template<class T>
 		BSONEmitter &BSONValueEmitter::append( const T &t ) {
-			mongo::BSONEmitter b;
+			// Emit straight into the parent buffer, instead of building a
+			// separate object and copying it in
+			BSONObjBuilder sub( subobjStart() );
+			mongo::BSONEmitter b( &sub );
 			b << t;
-			return this->append( b.obj() );
+			sub.done();
+			return (*pEmitter);
 		}
 
 	inline BSONEmitter &BSONValueEmitter::append( const double &t ) {
@@ -257,65 +312,172 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 	}
 
 
+	/**
+	 * \brief Precomputed decimal field names for array indices
+	 *
+	 * BSON arrays are objects keyed "0", "1", ... Formatting those keys is a
+	 * large share of the cost of emitting arrays of small values, so the
+	 * first size keys are formatted once and shared.
+	 */
+	class BSONArrayKeys {
+		public:
+			static const int size = 10000;
+
+			static StringData key( int i ) {
+				static const BSONArrayKeys keys;
+				return StringData( keys.data + stride*i, 
+						i < 10 ? 1 : ( i < 100 ? 2 : ( i < 1000 ? 3 : 4 ) ) );
+			}
+
+		private:
+			static const int stride = 5;
+
+			BSONArrayKeys() {
+				for ( int i = 0; i < size; ++i )
+					snprintf( data + stride*i, stride, "%d", i );
+			}
+
+			char data[stride*size];
+	};
+
+	/// Double with -0.0 stored as 0.0 and all NaNs as the same quiet NaN
+	inline double canonicalDouble( double d ) {
+		if (d != d)
+			return std::numeric_limits<double>::quiet_NaN();
+		if (d == 0)
+			return 0.0;
+		return d;
+	}
+
 	class BSONArrayEmitter {
 		public:
-			BSONArrayEmitter() {}
+			BSONArrayEmitter() : index( 0 ) {}
+
+			/// Emit an array in place, started with subarrayStart() on a parent
+			BSONArrayEmitter( BufBuilder &baseBuilder ) 
+				: builder( baseBuilder ), index( 0 ) {}
 
 			template<class T>
 				BSONArrayEmitter &append( const T &t ) {
-					mongo::BSONEmitter b;
+					BSONObjBuilder sub( subobjStart() );
+					mongo::BSONEmitter b( &sub );
 					b << t;
-					builder.append( b.obj() ); 
+					sub.done();
 					return *this;
 				}
 
 			BSONArrayEmitter &append(	const double &t ) {
-				builder.append( t );
+				builder.append( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const long long &t ) {
-				builder.append( t );
+				builder.append( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const size_t &t ) {
 				// Casting to long long, which should be save enough
 				long long cpy = (long long) t;
-				builder.append( cpy );
+				builder.append( key(), cpy );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const bool &t ) {
-				builder.append( t );
+				builder.append( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const int &t ) {
-				builder.append( t );
+				builder.append( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const std::string &t ) {
-				builder.append( t );
+				builder.append( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const BSONArray &t ) {
-				builder.append( t );
+				builder.appendArray( key(), t );
 				return *this;
 			}
 
 			BSONArrayEmitter &append(	const OID &t ) {
-				builder.append( t );
+				builder.append( key(), t );
+				return *this;
+			}
+
+			BSONArrayEmitter &append(	const BSONElement &t ) {
+				builder.appendAs( t, key() );
 				return *this;
 			}
 
 			BSONArray arr() {
-				return builder.arr();
+				return BSONArray( builder.obj() );
+			}
+
+			/// Finish an array that is emitted in place
+			void done() {
+				builder.done();
+			}
+
+			/// Start a sub object/array as the next element in this buffer
+			BufBuilder &subobjStart() {
+				return builder.subobjStart( key() );
+			}
+
+			BufBuilder &subarrayStart() {
+				return builder.subarrayStart( key() );
+			}
+
+			/**
+			 * \brief Finish the array with its elements sorted on their encoded value
+			 *
+			 * Used for unordered containers, so that equal containers result in
+			 * identical bytes independent of their hash iteration order. The
+			 * order is deterministic, but not the natural order of the values.
+			 * Doubles are compared after canonicalDouble(), so that -0.0 and
+			 * 0.0, or different NaNs, end up in the same place.
+			 */
+			BSONArray sortedArr() {
+				BSONArray unsorted = arr();
+				std::vector<BSONElement> elements;
+				for ( BSONObjIterator i( unsorted ); i.more(); )
+					elements.push_back( i.next() );
+				std::sort( elements.begin(), elements.end(), 
+						[]( const BSONElement &a, const BSONElement &b ) {
+							if (a.type() != b.type())
+								return a.type() < b.type();
+							if (a.type() == NumberDouble) {
+								double x = canonicalDouble( a.Double() );
+								double y = canonicalDouble( b.Double() );
+								return memcmp( &x, &y, sizeof( double ) ) < 0;
+							}
+							int cmp = memcmp( a.value(), b.value(), 
+									std::min( a.valuesize(), b.valuesize() ) );
+							return cmp < 0 || ( cmp == 0 && a.valuesize() < b.valuesize() );
+						} );
+				BSONArrayEmitter sorted;
+				for ( auto &bel : elements )
+					sorted.append( bel );
+				return sorted.arr();
+			}
+
+		protected:
+			BSONObjBuilder builder;
+
+			/// Field name of the next element, identical to BSONArrayBuilder's
+			StringData key() {
+				int i = index++;
+				if (i < BSONArrayKeys::size)
+					return BSONArrayKeys::key( i );
+				snprintf( overflowKey, sizeof( overflowKey ), "%d", i );
+				return StringData( overflowKey );
 			}
 
-			BSONArrayBuilder builder;
+			int index;
+			char overflowKey[12];
 	};
 
 	template<class V>
@@ -348,6 +510,23 @@ void operator>>( const mongo::BSONObj &bobj, std::map<std::string,V> &map ) {
 			return wrap;
 		}
 
+	template<class V>
+		BSONEmitter &operator<<( BSONEmitter &wrap, 
+				const std::unordered_map<std::string,V> &t ) {
+			// Emit in key order, so that equal maps result in identical bytes
+			std::vector<const std::pair<const std::string,V> *> pairs;
+			for (auto & pair : t)
+				pairs.push_back( &pair );
+			std::sort( pairs.begin(), pairs.end(), 
+					[]( const std::pair<const std::string,V> *a, 
+						const std::pair<const std::string,V> *b ) {
+						return a->first < b->first;
+					} );
+			for (auto pPair : pairs)
+				wrap << *pPair;
+			return wrap;
+		}
+
 		BSONEmitter &operator<<( BSONEmitter &wrap, 
 				const OID &id );
 		inline BSONEmitter &operator<<( BSONEmitter &wrap, const OID &id ) {
@@ -376,81 +555,121 @@ mongo::BSONArrayEmitter &operator<<( mongo::BSONArrayEmitter &barr,
 template<class T>
 mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
 		const std::vector<T> &vt ) { 
-	mongo::BSONArrayEmitter b;
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	b.done();
+	return *bbuild.pEmitter;
 }
 
 template<class T>
 mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
 		const std::set<T> &vt ) { 
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
+	for ( const T &el : vt ) {
+		b << el;
+	}
+	b.done();
+	return *bbuild.pEmitter;
+}
+
+template<class T>
+mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
+		const std::unordered_set<T> &vt ) { 
 	mongo::BSONArrayEmitter b;
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	return bbuild.append( b.sortedArr() );
 }
 
 template<class T>
 mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
 		const std::list<T> &vt ) { 
-	mongo::BSONArrayEmitter b;
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	b.done();
+	return *bbuild.pEmitter;
 }
 
 template<class K, class V>
 mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
 		const std::pair<K,V> &p ) { 
-	mongo::BSONArrayEmitter b;
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
 	b << p.first << p.second;
-	return bbuild.append( b.arr() );
+	b.done();
+	return *bbuild.pEmitter;
 }
 
 template<class K, class V>
 mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
 		const std::map<K,V> &map ) { 
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
+	for (auto &p : map) {
+		mongo::BSONArrayEmitter b2( b.subarrayStart() );
+		b2 << p.first << p.second;
+		b2.done();
+	}
+	b.done();
+	return *bbuild.pEmitter;
+}
+
+template<class K, class V>
+mongo::BSONEmitter &operator<<( mongo::BSONValueEmitter &bbuild, 
+		const std::unordered_map<K,V> &map ) { 
 	mongo::BSONArrayEmitter b;
 	for (auto &p : map) {
-		mongo::BSONArrayEmitter b2;
+		mongo::BSONArrayEmitter b2( b.subarrayStart() );
 		b2 << p.first << p.second;
-		b.append( b2.arr() );
+		b2.done();
 	}
-	return bbuild.append( b.arr() );
+	return bbuild.append( b.sortedArr() );
 }
 
 template<class T>
 mongo::BSONArrayEmitter &operator<<( mongo::BSONArrayEmitter &bbuild, 
 		const std::vector<T> &vt ) { 
-	mongo::BSONArrayEmitter b;
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	b.done();
+	return bbuild;
 }
 
 template<class T>
 mongo::BSONArrayEmitter &operator<<( mongo::BSONArrayEmitter &bbuild, 
 		const std::set<T> &vt ) { 
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
+	for ( const T &el : vt ) {
+		b << el;
+	}
+	b.done();
+	return bbuild;
+}
+
+template<class T>
+mongo::BSONArrayEmitter &operator<<( mongo::BSONArrayEmitter &bbuild, 
+		const std::unordered_set<T> &vt ) { 
 	mongo::BSONArrayEmitter b;
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	return bbuild.append( b.sortedArr() );
 }
 
 template<class T>
 mongo::BSONArrayEmitter &operator<<( mongo::BSONArrayEmitter &bbuild, 
 		const std::list<T> &vt ) { 
-	mongo::BSONArrayEmitter b;
+	mongo::BSONArrayEmitter b( bbuild.subarrayStart() );
 	for ( const T &el : vt ) {
 		b << el;
 	}
-	return bbuild.append( b.arr() );
+	b.done();
+	return bbuild;
 }
 
 };
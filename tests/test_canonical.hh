@@ -0,0 +1,98 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_canonical.hh"
+using namespace mongo;
+
+class TestCanonical : public CxxTest::TestSuite {
+	public:
+		void testSortedFields() {
+			BSONCanonicalEmitter emit;
+			emit << "b" << 1.0 << "a" << 2.0;
+			BSONObj bobj = emit.obj();
+			TS_ASSERT_EQUALS( bobj, BSONObjBuilder().append( "a", 2.0 )
+					.append( "b", 1.0 ).obj() );
+		}
+
+		void testSortedEmbeddedFields() {
+			std::map<std::string, double> sub = {{"y", 1.0}, {"x", 2.0}};
+			std::vector<double> v = { 2.0, 1.0 };
+			BSONCanonicalEmitter emit;
+			emit << "sub" << std::vector<std::map<std::string, double> >( { sub } )
+				<< "v" << v;
+			BSONObj bobj = emit.obj();
+			BSONObj expected = BSONObjBuilder().append( "sub",
+					BSONArrayBuilder().append( BSONObjBuilder().append( "x", 2.0 )
+						.append( "y", 1.0 ).obj() ).arr() ).append( "v", v ).obj();
+			TS_ASSERT_EQUALS( bobj, expected );
+		}
+
+		void testNormalizedNumbers() {
+			BSONCanonicalEmitter emit;
+			emit << "int" << 1 << "zero" << -0.0;
+			BSONObj bobj = emit.obj();
+			TS_ASSERT_EQUALS( bobj, BSONObjBuilder().append( "int", 1LL )
+					.append( "zero", 0.0 ).obj() );
+		}
+
+		void testHash() {
+			BSONCanonicalEmitter emit1;
+			emit1 << "a" << 1 << "b" << 0.0;
+			emit1.obj();
+			BSONCanonicalEmitter emit2;
+			emit2 << "b" << -0.0 << "a" << 1LL;
+			emit2.obj();
+			TS_ASSERT_EQUALS( emit1.hash(), emit2.hash() );
+
+			BSONCanonicalEmitter emit3;
+			emit3 << "a" << 1 << "b" << 1.0;
+			emit3.obj();
+			TS_ASSERT_DIFFERS( emit1.hash(), emit3.hash() );
+		}
+
+		void testNaN() {
+			BSONCanonicalEmitter emit1;
+			emit1 << "a" << std::numeric_limits<double>::quiet_NaN();
+			BSONObj bobj1 = emit1.obj();
+			BSONCanonicalEmitter emit2;
+			emit2 << "a" << -std::numeric_limits<double>::quiet_NaN();
+			BSONObj bobj2 = emit2.obj();
+			TS_ASSERT_EQUALS( bobj1, bobj2 );
+			TS_ASSERT_EQUALS( emit1.hash(), emit2.hash() );
+		}
+
+		void testUnorderedMap() {
+			std::unordered_map<std::string, int> map1( 1 );
+			std::unordered_map<std::string, int> map2( 64 );
+			for ( int i = 0; i < 20; ++i ) {
+				map1[std::to_string( i )] = i;
+				map2[std::to_string( 19 - i )] = 19 - i;
+			}
+			BSONCanonicalEmitter emit1;
+			emit1 << "map" << map1;
+			BSONCanonicalEmitter emit2;
+			emit2 << "map" << map2;
+			TS_ASSERT_EQUALS( emit1.obj(), emit2.obj() );
+			TS_ASSERT_EQUALS( emit1.hash(), emit2.hash() );
+		}
+
+		void testUnorderedSetZero() {
+			// -0.0 sorts on its normalized value, not on its raw bytes
+			std::unordered_set<double> set1 = { 0.0, 2.0 };
+			std::unordered_set<double> set2 = { -0.0, 2.0 };
+			BSONCanonicalEmitter emit1;
+			emit1 << "set" << set1;
+			BSONCanonicalEmitter emit2;
+			emit2 << "set" << set2;
+			TS_ASSERT( emit1.obj().binaryEqual( emit2.obj() ) );
+			TS_ASSERT_EQUALS( emit1.hash(), emit2.hash() );
+		}
+
+		void testAlreadyCanonical() {
+			BSONCanonicalEmitter emit;
+			emit << "a" << 1LL << "b" << 2.0;
+			BSONObj bobj = emit.obj();
+			TS_ASSERT( bobj.binaryEqual( BSONObjBuilder().append( "a", 1LL )
+						.append( "b", 2.0 ).obj() ) );
+			TS_ASSERT_EQUALS( emit.hash(),
+					BSONContentHash::hash( bobj.objdata(), bobj.objsize() ) );
+		}
+};
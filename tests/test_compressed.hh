@@ -0,0 +1,163 @@
+#include <cxxtest/TestSuite.h>
+#include <cstdlib>
+#include <sstream>
+#include "bson/bson_compressed.hh"
+using namespace mongo;
+
+class test {
+	public:
+		int i;
+		std::string s;
+		std::vector<double> v;
+
+		friend void operator>>( const BSONElement &bel, test &t ) {
+			bel["i"] >> t.i;
+			bel["s"] >> t.s;
+			bel["v"] >> t.v;
+		}
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const test &t ) {
+			bbuild << "i" << t.i << "s" << t.s << "v" << t.v;
+			return bbuild;
+		}
+};
+
+class TestCompressed : public CxxTest::TestSuite {
+	public:
+		std::string roundTrip( const std::string &raw ) {
+			std::string compressed;
+			BSONBlockCodec::compress( raw.data(), raw.size(), compressed );
+			std::string result( raw.size(), '\0' );
+			BSONBlockCodec::decompress( compressed.data(), compressed.size(),
+					&result[0], result.size() );
+			return result;
+		}
+
+		void testCodec() {
+			TS_ASSERT_EQUALS( roundTrip( "" ), "" );
+			TS_ASSERT_EQUALS( roundTrip( "abc" ), "abc" );
+			std::string repeated( 1000, 'a' );
+			TS_ASSERT_EQUALS( roundTrip( repeated ), repeated );
+			std::string random;
+			srand( 1 );
+			for ( int i = 0; i < 100000; ++i )
+				random.push_back( (char) ( rand() % ( i % 7 == 0 ? 256 : 4 ) ) );
+			TS_ASSERT_EQUALS( roundTrip( random ), random );
+
+			std::string compressed;
+			BSONBlockCodec::compress( repeated.data(), repeated.size(), compressed );
+			TS_ASSERT_LESS_THAN( compressed.size(), 20 );
+		}
+
+		void testCorrupt() {
+			std::string raw( 1000, 'a' );
+			std::string compressed;
+			BSONBlockCodec::compress( raw.data(), raw.size(), compressed );
+			TS_ASSERT_THROWS_ANYTHING( BSONBlockCodec::decompress( compressed.data(),
+						compressed.size() / 2, &raw[0], raw.size() ) );
+			TS_ASSERT_THROWS_ANYTHING( BSONBlockCodec::decompress( compressed.data(),
+						compressed.size(), &raw[0], raw.size() - 1 ) );
+		}
+
+		void testStream() {
+			std::stringstream file;
+			{
+				BSONBlockWriter writer( file, 4096 );
+				for ( int i = 0; i < 1000; ++i ) {
+					test t;
+					t.i = i;
+					t.s = "document";
+					t.v = { 1.0, (double) i };
+					writer << t;
+				}
+			}
+			TS_ASSERT_LESS_THAN( file.str().size(), 1000*60 );
+
+			BSONBlockReader reader( file );
+			test t;
+			int count = 0;
+			while ( reader.next( t ) ) {
+				TS_ASSERT_EQUALS( t.i, count );
+				TS_ASSERT_EQUALS( t.s, "document" );
+				TS_ASSERT_EQUALS( t.v[1], count );
+				++count;
+			}
+			TS_ASSERT_EQUALS( count, 1000 );
+		}
+
+		void testBlocks() {
+			std::stringstream file;
+			{
+				BSONBlockWriter writer( file, 64 );
+				for ( int i = 0; i < 10; ++i )
+					writer << BSONObjBuilder().append( "i", i ).obj();
+			}
+			BSONBlockReader reader( file );
+			std::vector<BSONBlock> blocks;
+			BSONBlock block;
+			while ( reader.nextBlock( block ) )
+				blocks.push_back( block );
+			TS_ASSERT_LESS_THAN( 1, blocks.size() );
+			int i = 0;
+			for ( auto &b : blocks ) {
+				b.decompress();
+				BSONObj bobj;
+				while ( b.next( bobj ) )
+					TS_ASSERT_EQUALS( bobj["i"].Int(), i++ );
+			}
+			TS_ASSERT_EQUALS( i, 10 );
+		}
+
+		void testTruncated() {
+			std::stringstream file;
+			{
+				BSONBlockWriter writer( file );
+				writer << BSONObjBuilder().append( "i", 1 ).obj();
+			}
+			std::string data = file.str();
+			std::stringstream truncated( data.substr( 0, data.size() - 1 ) );
+			BSONBlockReader reader( truncated );
+			BSONObj bobj;
+			TS_ASSERT_THROWS_ANYTHING( reader.next( bobj ) );
+		}
+
+		void testMagic() {
+			std::stringstream file( "not a stream" );
+			BSONBlockReader reader( file );
+			BSONObj bobj;
+			TS_ASSERT_THROWS_ANYTHING( reader.next( bobj ) );
+		}
+
+		void testInvalidDocument() {
+			std::stringstream file;
+			{
+				BSONBlockWriter writer( file );
+				writer << BSONObjBuilder().append( "i", 1 ).obj();
+			}
+			// Too small to compress, so the document is stored as is after the
+			// stream and block headers. Overwrite its first type byte.
+			std::string data = file.str();
+			data[8 + 8 + 4] = (char) 0x55;
+			std::stringstream invalid( data );
+			BSONBlockReader reader( invalid );
+			BSONObj bobj;
+			TS_ASSERT_THROWS_ANYTHING( reader.next( bobj ) );
+		}
+
+		void testOversizedHeader() {
+			// A tiny block that claims to expand to 2GB is rejected before allocating
+			char data[24] = { 'B', 'S', 'N', 'Z', 1, 0, 0, 0 };
+			BSONBlockCodec::storeUInt32( data + 8, 0x7fffffff );
+			BSONBlockCodec::storeUInt32( data + 12, 8 );
+			std::stringstream hostile( std::string( data, sizeof( data ) ) );
+			BSONBlockReader reader( hostile );
+			BSONBlock block;
+			TS_ASSERT_THROWS_ANYTHING( reader.nextBlock( block ) );
+		}
+
+		void testBlockSizeLimit() {
+			std::stringstream file;
+			TS_ASSERT_THROWS_ANYTHING( BSONBlockWriter writer( file,
+						(size_t) std::numeric_limits<int>::max() + 1 ) );
+		}
+};
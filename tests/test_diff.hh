@@ -0,0 +1,143 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_diff.hh"
+using namespace mongo;
+
+class sub {
+	public:
+		double x;
+		double y;
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const sub &s ) {
+			bbuild << "x" << s.x << "y" << s.y;
+			return bbuild;
+		}
+};
+
+class attributes {
+	public:
+		std::map<std::string, double> values;
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const attributes &a ) {
+			bbuild << a.values;
+			return bbuild;
+		}
+};
+
+class record {
+	public:
+		std::string name;
+		sub position;
+		std::vector<int> v;
+		attributes m;
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const record &r ) {
+			bbuild << "name" << r.name << "position" << r.position
+				<< "v" << r.v << "m" << r.m;
+			return bbuild;
+		}
+};
+
+class TestDiff : public CxxTest::TestSuite {
+	public:
+		record before;
+
+		void setUp() {
+			before.name = "a";
+			before.position.x = 1.0;
+			before.position.y = 2.0;
+			before.v = { 1, 2, 3 };
+			before.m.values = { { "k", 1.0 }, { "l", 2.0 } };
+		}
+
+		void testUnchanged() {
+			BSONDiff diff( before, before );
+			TS_ASSERT( !diff.changed() );
+			TS_ASSERT( diff.obj().isEmpty() );
+		}
+
+		void testField() {
+			record after = before;
+			after.name = "b";
+			BSONDiff diff( before, after );
+			TS_ASSERT( diff.changed() );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set",
+						BSONObjBuilder().append( "name", "b" ).obj() ).obj() );
+		}
+
+		void testEmbedded() {
+			record after = before;
+			after.position.y = 3.0;
+			after.v[1] = 5;
+			BSONDiff diff( before, after );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set",
+						BSONObjBuilder().append( "position.y", 3.0 )
+						.append( "v.1", 5 ).obj() ).obj() );
+		}
+
+		void testArrayLength() {
+			record after = before;
+			after.v.push_back( 4 );
+			BSONDiff diff( before, after );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set",
+						BSONObjBuilder().append( "v", after.v ).obj() ).obj() );
+		}
+
+		void testRemoved() {
+			record after = before;
+			after.m.values.erase( "k" );
+			after.m.values["n"] = 3.0;
+			BSONDiff diff( before, after );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder()
+					.append( "$set", BSONObjBuilder().append( "m.n", 3.0 ).obj() )
+					.append( "$unset", BSONObjBuilder().append( "m.k", "" ).obj() ).obj() );
+		}
+
+		void testFromBSONObj() {
+			BSONEmitter bbuild;
+			bbuild << before;
+			BSONObj stored = bbuild.obj();
+			record after = before;
+			after.position.x = 0.5;
+			BSONDiff diff( stored, after );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set",
+						BSONObjBuilder().append( "position.x", 0.5 ).obj() ).obj() );
+		}
+
+		void testTypeChange() {
+			BSONObj stored = BSONObjBuilder().append( "a", 1 )
+				.append( "b", BSONObjBuilder().append( "c", 1 ).obj() ).obj();
+			BSONObj changed = BSONObjBuilder().append( "a", 1.0 ).append( "b", 2 ).obj();
+			BSONDiff diff( stored, changed );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set", changed ).obj() );
+		}
+
+		void testInsertedField() {
+			BSONObj stored = BSONObjBuilder().append( "a", 1 ).append( "b", 2 )
+				.append( "c", 3 ).obj();
+			BSONObj changed = BSONObjBuilder().append( "x", 0 ).append( "a", 1 )
+				.append( "b", 2 ).append( "c", 4 ).obj();
+			BSONDiff diff( stored, changed );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set",
+						BSONObjBuilder().append( "x", 0 ).append( "c", 4 ).obj() ).obj() );
+		}
+
+		void testInvalidNames() {
+			BSONObj stored = BSONObjBuilder().append( "m",
+					BSONObjBuilder().append( "a.b", 1 ).obj() ).obj();
+			BSONObj changed = BSONObjBuilder().append( "m",
+					BSONObjBuilder().append( "a.b", 2 ).obj() ).obj();
+			BSONDiff diff( stored, changed );
+			TS_ASSERT_EQUALS( diff.obj(), BSONObjBuilder().append( "$set", changed ).obj() );
+
+			BSONObj root = BSONObjBuilder().append( "$a", 1 ).obj();
+			TS_ASSERT_THROWS_ANYTHING( BSONDiff rootDiff( stored, root ) );
+		}
+
+		void testObjTwice() {
+			record after = before;
+			after.name = "b";
+			BSONDiff diff( before, after );
+			BSONObj update = diff.obj();
+			TS_ASSERT_EQUALS( diff.obj(), update );
+		}
+};
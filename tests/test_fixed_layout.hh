@@ -0,0 +1,60 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_fixed_layout.hh"
+using namespace mongo;
+
+class metric {
+	public:
+		long long count;
+		double mean;
+		int code;
+		bool ok;
+		std::string name;
+		metric() : count(3), mean(1.5), code(-2), ok(true), name("m") {}
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const metric &m ) {
+			static const BSONFixedLayout<long long, double, int, bool> layout( 
+					"count", "mean", "code", "ok" );
+			layout.emit( bbuild, m.count, m.mean, m.code, m.ok );
+			bbuild << "name" << m.name;
+			return bbuild;
+		}
+};
+
+class TestFixedLayout : public CxxTest::TestSuite {
+	public:
+		BSONObj expected( const metric &m ) {
+			return BSONObjBuilder().append( "count", m.count ).append( "mean", m.mean )
+				.append( "code", m.code ).append( "ok", m.ok )
+				.append( "name", m.name ).obj();
+		}
+
+		void testEmit() {
+			metric m;
+			BSONEmitter bbuild;
+			bbuild << m;
+			TS_ASSERT_EQUALS( bbuild.obj(), expected( m ) );
+		}
+
+		void testEmitAsValue() {
+			std::vector<metric> vm( 2 );
+			vm[1].count = 4;
+			vm[1].ok = false;
+			BSONEmitter bbuild;
+			bbuild << "size" << vm.size() << "metrics" << vm;
+			BSONObj bobj = BSONObjBuilder().append( "size", 2LL ).append( "metrics",
+					BSONArrayBuilder().append( expected( vm[0] ) )
+					.append( expected( vm[1] ) ).arr() ).obj();
+			TS_ASSERT_EQUALS( bbuild.obj(), bobj );
+		}
+
+		void testTypes() {
+			BSONFixedLayout<size_t, OID> layout( "size", "_id" );
+			auto oid = OID::gen();
+			size_t st = 7;
+			BSONEmitter bbuild;
+			layout.emit( bbuild, st, oid );
+			TS_ASSERT_EQUALS( bbuild.obj(), BSONObjBuilder().append( "size", 7LL )
+					.append( "_id", oid ).obj() );
+			TS_ASSERT_EQUALS( layout.size(), 1 + 5 + 8 + 1 + 4 + 12 );
+		}
+};
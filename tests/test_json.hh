@@ -0,0 +1,157 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_json.hh"
+using namespace mongo;
+
+class test {
+	public:
+		double a;
+		std::string b;
+		test() {};
+		test( double a, const std::string &b ) : a(a), b(b) {}
+
+		friend void operator>>( const BSONElement &bel, test &t ) {
+			bel["a"] >> t.a;
+			bel["b"] >> t.b;
+		}
+
+		friend BSONEmitter &operator<<( BSONEmitter &bbuild, const test &t ) {
+			bbuild << "a" << t.a;
+			bbuild << "b" << t.b;
+			return bbuild;
+		}
+};
+
+class TestJSON : public CxxTest::TestSuite {
+	public:
+		BSONObj roundTrip( const BSONObj &bobj, bool canonical = false ) {
+			ExtJSONWriter writer( canonical );
+			writer << bobj;
+			ExtJSONReader reader( writer.str() );
+			BSONObj result;
+			TS_ASSERT( reader.next( result ) );
+			return result;
+		}
+
+		void testWriteUserType() {
+			ExtJSONWriter writer;
+			writer << test( 1.5, "x" );
+			TS_ASSERT_EQUALS( writer.str(), "{\"a\":1.5,\"b\":\"x\"}\n" );
+			writer.clear();
+			writer << test( 2.0, "y" );
+			TS_ASSERT_EQUALS( writer.str(), "{\"a\":2.0,\"b\":\"y\"}\n" );
+		}
+
+		void testWriteTypes() {
+			ExtJSONWriter writer;
+			writer << BSONObjBuilder().append( "i", 1 ).append( "l", 2LL )
+				.append( "t", true ).appendNull( "n" )
+				.append( "v", std::vector<double>( { 0.1, -3e20 } ) ).obj();
+			TS_ASSERT_EQUALS( writer.str(), "{\"i\":1,\"l\":{\"$numberLong\":\"2\"},"
+					"\"t\":true,\"n\":null,\"v\":[0.1,-3e+20]}\n" );
+
+			ExtJSONWriter canonical( true );
+			canonical << BSONObjBuilder().append( "i", 1 ).append( "d", 1.0 ).obj();
+			TS_ASSERT_EQUALS( canonical.str(), "{\"i\":{\"$numberInt\":\"1\"},"
+					"\"d\":{\"$numberDouble\":\"1.0\"}}\n" );
+		}
+
+		void testEscape() {
+			ExtJSONWriter writer;
+			std::string s = "a long string with \"quotes\", a \\ and a\nnewline\x01";
+			writer << BSONObjBuilder().append( "s", s ).obj();
+			TS_ASSERT_EQUALS( writer.str(), "{\"s\":\"a long string with \\\"quotes\\\", "
+					"a \\\\ and a\\nnewline\\u0001\"}\n" );
+			TS_ASSERT_EQUALS( roundTrip( BSONObjBuilder().append( "s", s ).obj() )["s"].String(), s );
+		}
+
+		void testRoundTrip() {
+			unsigned char bin[] = { 0, 1, 2, 250, 251 };
+			BSONObj bobj = BSONObjBuilder().append( "d", 0.1 ).append( "i", -7 )
+				.append( "l", 1LL << 40 ).append( "s", "\xc3\xa9" )
+				.append( "o", OID::gen() ).append( "b", false )
+				.appendBinData( "bin", 5, BinDataGeneral, bin )
+				.append( "sub", BSONObjBuilder().append( "$set", 1 ).obj() )
+				.append( "v", std::vector<int>( { 1, 2, 3 } ) ).obj();
+			TS_ASSERT_EQUALS( roundTrip( bobj ), bobj );
+			TS_ASSERT_EQUALS( roundTrip( bobj, true ), bobj );
+		}
+
+		void testRead() {
+			ExtJSONReader reader( " {\"a\" : 1.5, \"b\": \"\\u00e9\\ud83d\\ude00\"}\n"
+					"{\"a\": 2, \"b\": \"\"} " );
+			BSONObj bobj;
+			test t;
+			TS_ASSERT( reader.next( bobj ) );
+			bobj >> t;
+			TS_ASSERT_EQUALS( t.a, 1.5 );
+			TS_ASSERT_EQUALS( t.b, "\xc3\xa9\xf0\x9f\x98\x80" );
+			TS_ASSERT( reader.next( bobj ) );
+			TS_ASSERT_EQUALS( bobj["a"].type(), NumberInt );
+			TS_ASSERT( !reader.next( bobj ) );
+		}
+
+		void testInvalid() {
+			BSONObj bobj;
+			ExtJSONReader reader1( "{\"a\": }" );
+			TS_ASSERT_THROWS_ANYTHING( reader1.next( bobj ) );
+			ExtJSONReader reader2( "{\"a\": \"unterminated}" );
+			TS_ASSERT_THROWS_ANYTHING( reader2.next( bobj ) );
+		}
+
+		void testInvalidInteger() {
+			BSONObj bobj;
+			ExtJSONReader reader1( "{\"a\": {\"$numberInt\": \"abc\"}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader1.next( bobj ) );
+			ExtJSONReader reader2( "{\"a\": {\"$numberInt\": \"2147483648\"}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader2.next( bobj ) );
+			ExtJSONReader reader3( "{\"a\": {\"$numberLong\": \"99999999999999999999\"}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader3.next( bobj ) );
+		}
+
+		void testIsoDate() {
+			ExtJSONReader reader( "{\"a\": {\"$date\": \"1970-01-01T00:00:00Z\"}, "
+					"\"b\": {\"$date\": \"2024-02-29T12:34:56.789+01:00\"}}" );
+			BSONObj bobj;
+			TS_ASSERT( reader.next( bobj ) );
+			TS_ASSERT_EQUALS( bobj["a"].type(), Date );
+			TS_ASSERT_EQUALS( bobj["a"].date().millis, 0ULL );
+			TS_ASSERT_EQUALS( bobj["b"].date().millis, 1709206496789ULL );
+		}
+
+		void testInvalidDouble() {
+			BSONObj bobj;
+			ExtJSONReader reader1( "{\"a\": {\"$numberDouble\": \"abc\"}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader1.next( bobj ) );
+			ExtJSONReader reader2( "{\"a\": {\"$numberDouble\": \"1e999\"}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader2.next( bobj ) );
+			ExtJSONReader reader3( "{\"a\": {\"$numberDouble\": \"1.5\"}}" );
+			TS_ASSERT( reader3.next( bobj ) );
+			TS_ASSERT_EQUALS( bobj["a"].Double(), 1.5 );
+		}
+
+		void testInvalidBinary() {
+			BSONObj bobj;
+			ExtJSONReader reader1( "{\"a\": {\"$binary\": "
+					"{\"base64\": \"AAE=\", \"subType\": \"zz\"}}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader1.next( bobj ) );
+			ExtJSONReader reader2( "{\"a\": {\"$binary\": "
+					"{\"base64\": \"AAE=\", \"subType\": \"100\"}}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader2.next( bobj ) );
+		}
+
+		void testInvalidTimestamp() {
+			BSONObj bobj;
+			ExtJSONReader reader1( "{\"a\": {\"$timestamp\": {\"t\": -1, \"i\": 1}}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader1.next( bobj ) );
+			ExtJSONReader reader2( "{\"a\": {\"$timestamp\": {\"t\": 4294967296, \"i\": 1}}}" );
+			TS_ASSERT_THROWS_ANYTHING( reader2.next( bobj ) );
+		}
+
+		void testWriteDouble() {
+			ExtJSONWriter writer;
+			writer << BSONObjBuilder().append( "a", 123456789.0 ).append( "b", 0.00001 )
+				.append( "c", -0.0 ).append( "d", 1.0/3 ).obj();
+			TS_ASSERT_EQUALS( writer.str(), "{\"a\":123456789.0,\"b\":0.00001,"
+					"\"c\":-0.0,\"d\":0.33333333333333331}\n" );
+		}
+};
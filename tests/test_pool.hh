@@ -0,0 +1,76 @@
+#include <cxxtest/TestSuite.h>
+#include <thread>
+#include "bson/bson_pool.hh"
+using namespace mongo;
+
+class TestPool : public CxxTest::TestSuite {
+	public:
+		void setUp() {
+			BSONBufferPool::instance().setMaxBytes( 64*1024*1024 );
+		}
+
+		void testEmit() {
+			std::vector<double> v = { 1.1, -2.1 };
+			BSONPooledEmitter bbuild;
+			bbuild << "a" << 1.0 << "v" << v;
+			BSONPooledObj pooled = bbuild.obj();
+			mongo::BSONObj bobj = mongo::BSONObjBuilder().append("a", 1.0)
+				.append("v", v).obj();
+			TS_ASSERT_EQUALS( pooled.obj(), bobj );
+		}
+
+		void testReuse() {
+			{
+				BSONPooledEmitter bbuild;
+				bbuild << "a" << 1.0;
+				bbuild.obj();
+			}
+			BSONBufferPool::Stats before = BSONBufferPool::instance().stats();
+			TS_ASSERT_LESS_THAN( 0, before.bytesHeld );
+			BSONPooledEmitter bbuild;
+			bbuild << "b" << 2.0;
+			BSONPooledObj pooled = bbuild.obj();
+			BSONBufferPool::Stats after = BSONBufferPool::instance().stats();
+			TS_ASSERT_EQUALS( after.hits, before.hits + 1 );
+			TS_ASSERT_EQUALS( after.misses, before.misses );
+			TS_ASSERT_EQUALS( pooled.obj()["b"].Number(), 2.0 );
+		}
+
+		void testMaxBytes() {
+			BSONBufferPool::instance().setMaxBytes( 0 );
+			BSONBufferPool::Stats before = BSONBufferPool::instance().stats();
+			{
+				BSONPooledEmitter bbuild;
+				bbuild << "a" << 1.0;
+				bbuild.obj();
+			}
+			BSONBufferPool::Stats after = BSONBufferPool::instance().stats();
+			TS_ASSERT_EQUALS( after.drops, before.drops + 1 );
+			TS_ASSERT( after.bytesHeld <= before.bytesHeld );
+		}
+
+		void testThreads() {
+			// Producers emit documents that are released by the main thread
+			std::vector<std::thread> producers;
+			std::vector<std::vector<BSONPooledObj> > docs( 4 );
+			for ( size_t t = 0; t < docs.size(); ++t ) {
+				producers.push_back( std::thread( [&docs, t]() {
+						for ( int i = 0; i < 100; ++i ) {
+							BSONPooledEmitter bbuild;
+							bbuild << "t" << (int) t << "i" << i;
+							docs[t].push_back( bbuild.obj() );
+						}
+					} ) );
+			}
+			for ( auto &producer : producers )
+				producer.join();
+			for ( size_t t = 0; t < docs.size(); ++t ) {
+				TS_ASSERT_EQUALS( docs[t].size(), 100 );
+				TS_ASSERT_EQUALS( docs[t][99].obj()["t"].Int(), (int) t );
+				TS_ASSERT_EQUALS( docs[t][99].obj()["i"].Int(), 99 );
+			}
+			docs.clear();
+			BSONBufferPool::Stats stats = BSONBufferPool::instance().stats();
+			TS_ASSERT( stats.bytesHeld <= 64*1024*1024 );
+		}
+};
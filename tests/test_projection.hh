@@ -0,0 +1,94 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_projection.hh"
+using namespace mongo;
+
+class stats {
+	public:
+		double p50;
+		double p99;
+		stats() : p50(0), p99(0) {}
+
+		friend void operator>>( const BSONElement &bel, stats &s ) {
+			BSONProjection proj;
+			proj.add( "p99", s.p99 );
+			bel >> proj;
+		}
+};
+
+class TestProjection : public CxxTest::TestSuite {
+	public:
+		BSONObj bobj;
+		void setUp() {
+			std::vector<double> blob( 1000, 1.1 );
+			bobj = BSONObjBuilder().append( "blob", blob )
+				.append( "name", "metric" )
+				.append( "stats", BSONObjBuilder().append( "p50", 1.0 )
+						.append( "p99", 9.0 ).obj() )
+				.append( "count", 3 ).obj();
+		}
+
+		void testTopLevel() {
+			std::string name;
+			int count = 0;
+			BSONProjection proj;
+			proj.add( "name", name ).add( "count", count );
+			bobj >> proj;
+			TS_ASSERT_EQUALS( name, "metric" );
+			TS_ASSERT_EQUALS( count, 3 );
+		}
+
+		void testNested() {
+			double p99 = 0;
+			BSONProjection proj;
+			proj.add( "stats.p99", p99 );
+			bobj >> proj;
+			TS_ASSERT_EQUALS( p99, 9.0 );
+		}
+
+		void testNestedAndParent() {
+			double p50 = 0;
+			stats s;
+			BSONProjection proj;
+			proj.add( "stats", s ).add( "stats.p50", p50 );
+			bobj >> proj;
+			TS_ASSERT_EQUALS( s.p99, 9.0 );
+			TS_ASSERT_EQUALS( s.p50, 0 );
+			TS_ASSERT_EQUALS( p50, 1.0 );
+		}
+
+		void testMissing() {
+			double missing = -1;
+			std::vector<double> blob;
+			BSONProjection proj;
+			proj.add( "stats.p75", missing ).add( "blob", blob );
+			TS_ASSERT_THROWS_NOTHING( bobj >> proj );
+			TS_ASSERT_EQUALS( missing, -1 );
+			TS_ASSERT_EQUALS( blob.size(), 1000 );
+		}
+
+		void testElement() {
+			stats s;
+			bobj["stats"] >> s;
+			TS_ASSERT_EQUALS( s.p99, 9.0 );
+		}
+
+		void testDuplicatePath() {
+			std::string first, second;
+			BSONProjection proj;
+			proj.add( "name", first ).add( "name", second );
+			bobj >> proj;
+			TS_ASSERT_EQUALS( first, "metric" );
+			TS_ASSERT_EQUALS( second, "metric" );
+		}
+
+		void testDuplicateKey() {
+			BSONObj dup = BSONObjBuilder().append( "a", 1 ).append( "a", 2 )
+				.append( "b", 3 ).obj();
+			int a = 0, b = 0;
+			BSONProjection proj;
+			proj.add( "a", a ).add( "b", b );
+			dup >> proj;
+			TS_ASSERT_EQUALS( a, 2 );
+			TS_ASSERT_EQUALS( b, 3 );
+		}
+};
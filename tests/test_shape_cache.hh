@@ -0,0 +1,120 @@
+#include <cxxtest/TestSuite.h>
+#include "bson/bson_shape_cache.hh"
+using namespace mongo;
+
+class metric {
+	public:
+		long long count;
+		double mean;
+		double p99;
+		metric() : count(0), mean(0), p99(0) {}
+
+		friend void operator>>( const BSONElement &bel, metric &m ) {
+			BSONCachedProjection<metric> proj;
+			proj.add( "count", m.count ).add( "mean", m.mean )
+				.add( "stats.p99", m.p99 );
+			bel >> proj;
+		}
+};
+
+class named {
+	public:
+		std::string name;
+		double value;
+		named() : value(0) {}
+
+		friend void operator>>( const BSONElement &bel, named &n ) {
+			BSONCachedProjection<named> proj;
+			proj.add( "name", n.name ).add( "value", n.value );
+			bel >> proj;
+		}
+};
+
+class TestShapeCache : public CxxTest::TestSuite {
+	public:
+		BSONObj metricObj( long long count, double mean, double p99 ) {
+			return BSONObjBuilder().append( "count", count ).append( "mean", mean )
+				.append( "stats", BSONObjBuilder().append( "p50", 1.0 )
+						.append( "p99", p99 ).obj() )
+				.append( "tag", "not decoded" ).obj();
+		}
+
+		void testSameShape() {
+			for ( int i = 0; i < 3; ++i ) {
+				metric m;
+				BSONObjBuilder().append( "m", metricObj( i, 0.5*i, 2.0*i ) ).obj()["m"] >> m;
+				TS_ASSERT_EQUALS( m.count, i );
+				TS_ASSERT_EQUALS( m.mean, 0.5*i );
+				TS_ASSERT_EQUALS( m.p99, 2.0*i );
+			}
+		}
+
+		void testDifferentShape() {
+			metric m;
+			metricObj( 1, 1.5, 2.5 ) >> m;
+			BSONObj reordered = BSONObjBuilder().append( "mean", 3.5 )
+				.append( "count", 3LL )
+				.append( "stats", BSONObjBuilder().append( "p99", 4.5 ).obj() ).obj();
+			reordered >> m;
+			TS_ASSERT_EQUALS( m.count, 3 );
+			TS_ASSERT_EQUALS( m.mean, 3.5 );
+			TS_ASSERT_EQUALS( m.p99, 4.5 );
+		}
+
+		void testVariableSize() {
+			named n;
+			BSONObjBuilder().append( "name", "a" ).append( "value", 1.0 ).obj() >> n;
+			TS_ASSERT_EQUALS( n.name, "a" );
+			TS_ASSERT_EQUALS( n.value, 1.0 );
+			// Longer name moves value to a different offset
+			BSONObjBuilder().append( "name", "abc" ).append( "value", 2.0 ).obj() >> n;
+			TS_ASSERT_EQUALS( n.name, "abc" );
+			TS_ASSERT_EQUALS( n.value, 2.0 );
+			BSONObjBuilder().append( "name", "d" ).append( "value", 3.0 ).obj() >> n;
+			TS_ASSERT_EQUALS( n.name, "d" );
+			TS_ASSERT_EQUALS( n.value, 3.0 );
+		}
+
+		void testTwoProjections() {
+			metric m;
+			metricObj( 1, 1.5, 2.5 ) >> m;
+
+			// Same type, other paths in another order
+			double mean = 0;
+			long long count = 0;
+			BSONCachedProjection<metric> other;
+			other.add( "mean", mean ).add( "count", count );
+			metricObj( 7, 8.5, 9.5 ) >> other;
+			TS_ASSERT_EQUALS( mean, 8.5 );
+			TS_ASSERT_EQUALS( count, 7 );
+
+			// Path outside of the cached layout
+			std::string tag;
+			BSONCachedProjection<metric> tagged;
+			tagged.add( "tag", tag ).add( "count", count );
+			metricObj( 3, 0.5, 0.5 ) >> tagged;
+			TS_ASSERT_EQUALS( tag, "not decoded" );
+			TS_ASSERT_EQUALS( count, 3 );
+
+			metricObj( 4, 4.5, 5.5 ) >> m;
+			TS_ASSERT_EQUALS( m.count, 4 );
+			TS_ASSERT_EQUALS( m.mean, 4.5 );
+			TS_ASSERT_EQUALS( m.p99, 5.5 );
+		}
+
+		void testReusedProjection() {
+			metric m;
+			BSONCachedProjection<metric> proj;
+			proj.add( "count", m.count ).add( "mean", m.mean );
+			for ( int i = 0; i < 3; ++i ) {
+				metricObj( i, 0.5*i, 0 ) >> proj;
+				TS_ASSERT_EQUALS( m.count, i );
+				TS_ASSERT_EQUALS( m.mean, 0.5*i );
+			}
+			// Adding a path after decoding maps the layout again
+			proj.add( "stats.p99", m.p99 );
+			metricObj( 5, 5.5, 6.5 ) >> proj;
+			TS_ASSERT_EQUALS( m.count, 5 );
+			TS_ASSERT_EQUALS( m.p99, 6.5 );
+		}
+};
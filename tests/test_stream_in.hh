@@ -98,6 +98,18 @@ class TestIn : public CxxTest::TestSuite {
 			std::cout << bobj << std::endl; // This will crash if something went wrong
 		}
 
+		void testStringFieldName() {
+			test t(-1.1, 1.0);
+			auto oid = mongo::OID::gen();
+			mongo::BSONEmitter bbuild;
+			bbuild << std::string( "test" ) << t;
+			bbuild << std::string( "oid" ) << oid;
+			mongo::BSONObj bobj = mongo::BSONObjBuilder().append( "test", 
+					mongo::BSONObjBuilder().append(
+						"a", t.a).append( "b", t.b ).obj()).append( "oid", oid ).obj();
+			TS_ASSERT_EQUALS( bobj, bbuild.obj() );
+		}
+
 		void testVector() {
 			std::vector<double> v = { 1.1, -2.1 };
 			mongo::BSONEmitter bbuild;
@@ -153,11 +165,49 @@ class TestIn : public CxxTest::TestSuite {
 			helpTypes( vs );
 		}
 
+		void testLongVectorAsValue() {
+			// Crosses the end of the precomputed array key table
+			std::vector<int> vi;
+			mongo::BSONArrayBuilder barr;
+			for ( int i = 0; i < 12000; ++i ) {
+				vi.push_back( i );
+				barr.append( i );
+			}
+			mongo::BSONEmitter bbuild;
+			bbuild << "a" << vi;
+			mongo::BSONObj bobj = mongo::BSONObjBuilder().append("a", barr.arr()).obj();
+			// Compared on bytes: woCompare treats int and long long as equal
+			TS_ASSERT( bobj.binaryEqual( bbuild.obj() ) );
+		}
+
 		void testSetAsValue() {
 			std::set<std::string> vs = { "Hello world!", "Bla" };
 			helpTypes( vs );
 		}
 
+		void testUnorderedSetAsValue() {
+			// Equal sets result in identical bytes, whatever their iteration order
+			std::unordered_set<std::string> vs1( 1 );
+			std::unordered_set<std::string> vs2( 64 );
+			for ( int i = 0; i < 20; ++i ) {
+				vs1.insert( std::to_string( i ) );
+				vs2.insert( std::to_string( 19 - i ) );
+			}
+			mongo::BSONEmitter bbuild1;
+			bbuild1 << "a" << vs1;
+			mongo::BSONEmitter bbuild2;
+			bbuild2 << "a" << vs2;
+			TS_ASSERT_EQUALS( bbuild1.obj(), bbuild2.obj() );
+		}
+
+		void testUnorderedMap() {
+			std::unordered_map<std::string, double> mymap = {{"b", 2.0}, {"a", 1.0}};
+			mongo::BSONEmitter bbuild;
+			bbuild << mymap;
+			mongo::BSONObj bobj = mongo::BSONObjBuilder().append("a", 1.0).append("b", 2.0).obj();
+			TS_ASSERT_EQUALS( bobj, bbuild.obj() );
+		}
+
 		void testListAsValue() {
 			std::list<std::string> vs = { "Hello world!", "Bla" };
 			helpTypes( vs );
@@ -250,6 +300,17 @@ class TestIn : public CxxTest::TestSuite {
 			TS_ASSERT_EQUALS( map, map_cpy );
 		}
 
+		void testNonStringUnorderedMap() {
+			mongo::BSONEmitter bbuild;
+			std::unordered_map< int, double > map = {{1, 2.1},{2,3.1}};
+			bbuild << "map" << map;
+			auto obj = bbuild.obj();
+			std::unordered_map< int, double > map_cpy = {{0, 0}};
+			TS_ASSERT_DIFFERS( map, map_cpy );
+			obj["map"] >> map_cpy;
+			TS_ASSERT_EQUALS( map, map_cpy );
+		}
+
 		void testOIDs() {
 			auto oid1 = mongo::OID::gen();
 			auto oid2 = mongo::OID::gen();
@@ -100,6 +100,14 @@ class TestOut : public CxxTest::TestSuite {
 			TS_ASSERT_EQUALS( b.size(), 2 );
 		}
 
+		void testSimpleUnorderedSet() {
+			std::unordered_set<double> b;
+			bobj["b"] >> b;
+
+			std::unordered_set<double> compare = { 1.1, -2.9 };
+			TS_ASSERT_EQUALS( b, compare );
+		}
+
 		void testObjectToMap() {
 			BSONObj bobj = BSONObjBuilder().append("a", 2.01).append("b", 3.1 ).obj();
 			std::map<std::string, double> mymap;
@@ -112,6 +120,16 @@ class TestOut : public CxxTest::TestSuite {
 			TS_ASSERT_EQUALS( mymap.size(), 2 );
 		}
 
+		void testObjectToUnorderedMap() {
+			BSONObj bobj = BSONObjBuilder().append("a", 2.01).append("b", 3.1 ).obj();
+			std::unordered_map<std::string, double> mymap;
+			mymap["c"] = 3.0;
+			bobj >> mymap;
+			TS_ASSERT_EQUALS( mymap.size(), 2 );
+			TS_ASSERT_EQUALS( mymap["a"], 2.01 );
+			TS_ASSERT_EQUALS( mymap["b"], 3.1 );
+		}
+
 		void testClass() {
 			test test_c( 0, 0 );
 			mongo::BSONObj bobj2 = BSONObjBuilder().append( "a", 2.3 ). 